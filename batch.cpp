@@ -0,0 +1,310 @@
+#include "batch.h"
+#include <cstring>
+
+Chip8Batch::Chip8Batch(size_t count) : count(count), padded((count + 31) & ~static_cast<size_t>(31))
+{
+	for (auto& reg : V)
+		reg.assign(padded, 0);
+	for (auto& level : stack)
+		level.assign(count, 0);
+
+	index.assign(count, 0);
+	pc.assign(count, 0);
+	sp.assign(count, 0);
+	delay_timer.assign(count, 0);
+	sound_timer.assign(count, 0);
+	keys.assign(count, 0);
+	rng.assign(count, Chip8Rng());
+	memory.assign(count * MEMORY_SIZE, 0);
+	video.assign(count * VIDEO_HEIGHT, 0);
+	written.assign(MEMORY_SIZE, 0);
+	group.assign(padded, 0);
+	skip.assign(padded, 0);
+
+	Chip8 boot(0);
+	for (size_t lane = 0; lane < count; lane++)
+		load_lane(lane, boot);
+}
+
+bool Chip8Batch::load_rom(char const* filename)
+{
+	Chip8 boot(0);
+	if (!boot.LoadROM(filename))
+		return false;
+
+	boot_lanes(boot);
+	return true;
+}
+
+bool Chip8Batch::load_rom(const uint8_t* data, size_t size)
+{
+	Chip8 boot(0);
+	if (!boot.LoadROM(data, size))
+		return false;
+
+	boot_lanes(boot);
+	return true;
+}
+
+void Chip8Batch::boot_lanes(const Chip8& boot)
+{
+	for (size_t lane = 0; lane < count; lane++) {
+		Chip8Rng lane_rng = rng[lane];
+		load_lane(lane, boot);
+		rng[lane] = lane_rng;
+	}
+
+	// Every lane now holds the same image.
+	written.assign(MEMORY_SIZE, 0);
+}
+
+void Chip8Batch::load_lane(size_t lane, const Chip8& machine)
+{
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++)
+		V[i][lane] = machine.registers[i];
+	for (unsigned int i = 0; i < STACK_LEVELS; i++)
+		stack[i][lane] = machine.stack[i];
+
+	index[lane] = machine.index;
+	pc[lane] = machine.pc;
+	sp[lane] = machine.sp;
+	delay_timer[lane] = machine.delay_timer;
+	sound_timer[lane] = machine.sound_timer;
+	keys[lane] = machine.keys;
+	rng[lane] = machine.rng;
+	machine.copy_memory(&memory[lane * MEMORY_SIZE]);
+	memcpy(&video[lane * VIDEO_HEIGHT], machine.get_video(), VIDEO_HEIGHT * sizeof(uint64_t));
+
+	// The lane's memory may differ anywhere from the others'.
+	written.assign(MEMORY_SIZE, 1);
+}
+
+void Chip8Batch::step(unsigned int cycles)
+{
+	// Interleaving lanes instruction by instruction defeats branch prediction as soon as they diverge,
+	// so each lane is gathered out of the arrays, run for the whole step and scattered back.
+	for (size_t lane = 0; lane < count; lane++) {
+		Lane state;
+		gather(lane, state);
+		for (unsigned int c = 0; c < cycles; c++)
+			execute(state);
+		scatter(lane, state);
+	}
+}
+
+void Chip8Batch::gather(size_t lane, Lane& state)
+{
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++)
+		state.V[i] = V[i][lane];
+	for (unsigned int i = 0; i < STACK_LEVELS; i++)
+		state.stack[i] = stack[i][lane];
+
+	state.index = index[lane];
+	state.pc = pc[lane];
+	state.sp = sp[lane];
+	state.delay_timer = delay_timer[lane];
+	state.sound_timer = sound_timer[lane];
+	state.keys = keys[lane];
+	state.rng = rng[lane];
+	state.memory = &memory[lane * MEMORY_SIZE];
+	state.video = &video[lane * VIDEO_HEIGHT];
+	state.written = &written[0];
+	state.sprite_edge = sprite_edge;
+}
+
+void Chip8Batch::scatter(size_t lane, const Lane& state)
+{
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++)
+		V[i][lane] = state.V[i];
+	for (unsigned int i = 0; i < STACK_LEVELS; i++)
+		stack[i][lane] = state.stack[i];
+
+	index[lane] = state.index;
+	pc[lane] = state.pc;
+	sp[lane] = state.sp;
+	delay_timer[lane] = state.delay_timer;
+	sound_timer[lane] = state.sound_timer;
+	rng[lane] = state.rng;
+}
+
+void Chip8Batch::tick_timers()
+{
+	for (size_t lane = 0; lane < count; lane++) {
+		if (delay_timer[lane] > 0)
+			delay_timer[lane]--;
+
+		if (sound_timer[lane] > 0)
+			sound_timer[lane]--;
+	}
+}
+
+// Mirrors the Chip8 OP_* handlers and decode(), including their order of reads and writes.
+void Chip8Batch::execute(Lane& lane)
+{
+	uint8_t* mem = lane.memory;
+	uint16_t& PC = lane.pc;
+	uint16_t& I = lane.index;
+
+	uint16_t opcode = (mem[PC & 0xFFFu] << 8) | mem[(PC + 1) & 0xFFFu];
+	PC += 2;
+
+	uint8_t x = (opcode & 0x0F00u) >> 8u;
+	uint8_t y = (opcode & 0x00F0u) >> 4u;
+	uint8_t n = opcode & 0x000Fu;
+	uint8_t kk = opcode & 0x00FFu;
+	uint16_t nnn = opcode & 0x0FFFu;
+
+	uint8_t& Vx = lane.V[x];
+	uint8_t& Vy = lane.V[y];
+	uint8_t& VF = lane.V[0xF];
+
+	switch ((opcode & 0xF000u) >> 12u) {
+	case 0x0:
+		if (n == 0x0) {
+			memset(lane.video, 0, VIDEO_HEIGHT * sizeof(uint64_t));
+		}
+		else if (n == 0xE) {
+			lane.sp--;
+			PC = lane.stack[lane.sp & 0xFu];
+		}
+		break;
+	case 0x1:
+		PC = nnn;
+		break;
+	case 0x2:
+		lane.stack[lane.sp & 0xFu] = PC;
+		lane.sp++;
+		PC = nnn;
+		break;
+	case 0x3:
+		if (Vx == kk)
+			PC += 2;
+		break;
+	case 0x4:
+		if (Vx != kk)
+			PC += 2;
+		break;
+	case 0x5:
+		if (Vx == Vy)
+			PC += 2;
+		break;
+	case 0x6:
+		Vx = kk;
+		break;
+	case 0x7:
+		Vx += kk;
+		break;
+	case 0x8:
+		switch (n) {
+		case 0x0:
+			Vx = Vy;
+			break;
+		case 0x1:
+			Vx |= Vy;
+			break;
+		case 0x2:
+			Vx &= Vy;
+			break;
+		case 0x3:
+			Vx ^= Vy;
+			break;
+		case 0x4: {
+			uint16_t sum = Vx + Vy;
+			VF = sum > 255U ? 1 : 0;
+			Vx = sum & 0xFFu;
+			break;
+		}
+		case 0x5:
+			VF = Vx > Vy ? 1 : 0;
+			Vx -= Vy;
+			break;
+		case 0x6:
+			VF = Vx & 0x1u;
+			Vx >>= 1;
+			break;
+		case 0x7:
+			VF = Vy > Vx ? 1 : 0;
+			Vx = Vy - Vx;
+			break;
+		case 0xE:
+			VF = (Vx & 0x80u) >> 7u;
+			Vx <<= 1;
+			break;
+		}
+		break;
+	case 0x9:
+		if (Vx != Vy)
+			PC += 2;
+		break;
+	case 0xA:
+		I = nnn;
+		break;
+	case 0xB:
+		PC = lane.V[0] + nnn;
+		break;
+	case 0xC:
+		Vx = lane.rng.next_byte() & kk;
+		break;
+	case 0xD: {
+		uint32_t changed = 0;
+		VF = blit_sprite(lane.video, mem, I, Vx % VIDEO_WIDTH, Vy % VIDEO_HEIGHT, n, lane.sprite_edge, changed);
+		break;
+	}
+	case 0xE:
+		if (n == 0xE && (lane.keys & (1u << (Vx & 0xFu))))
+			PC += 2;
+		else if (n == 0x1 && !(lane.keys & (1u << (Vx & 0xFu))))
+			PC += 2;
+		break;
+	case 0xF:
+		switch (kk) {
+		case 0x07:
+			Vx = lane.delay_timer;
+			break;
+		case 0x0A: {
+			uint8_t key = 0;
+			while (key < KEY_COUNT && !(lane.keys & (1u << key)))
+				key++;
+			if (key < KEY_COUNT)
+				Vx = key;
+			else
+				PC -= 2;
+			break;
+		}
+		case 0x15:
+			lane.delay_timer = Vx;
+			break;
+		case 0x18:
+			lane.sound_timer = Vx;
+			break;
+		case 0x1E:
+			I += Vx;
+			break;
+		case 0x29:
+			I = FONTSET_START_ADDRESS + (5 * Vx);
+			break;
+		case 0x33: {
+			uint8_t value = Vx;
+			mem[(I + 2) & 0xFFFu] = value % 10;
+			value /= 10;
+			mem[(I + 1) & 0xFFFu] = value % 10;
+			value /= 10;
+			mem[I & 0xFFFu] = value % 10;
+			for (unsigned int i = 0; i < 3; i++)
+				lane.written[(I + i) & 0xFFFu] = 1;
+			break;
+		}
+		case 0x55:
+			for (uint8_t i = 0; i <= x; i++) {
+				mem[(I + i) & 0xFFFu] = lane.V[i];
+				lane.written[(I + i) & 0xFFFu] = 1;
+			}
+			break;
+		case 0x65:
+			for (uint8_t i = 0; i <= x; i++)
+				lane.V[i] = mem[(I + i) & 0xFFFu];
+			break;
+		}
+		break;
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef BATCH
+#define BATCH
+#include <vector>
+#include "cpu.h"
+
+// Many independent machines stored structure-of-arrays: all V0s together, all PCs together and so
+// on, with memory and video kept contiguous per lane. step() advances every lane by the same number
+// of instructions and each lane behaves exactly like a Chip8 seeded and driven the same way.
+class Chip8Batch {
+public:
+	explicit Chip8Batch(size_t count);
+
+	size_t size() const {
+		return count;
+	}
+
+	// Boots every lane from the ROM, as Chip8::LoadROM does.
+	bool load_rom(char const* filename);
+	bool load_rom(const uint8_t* data, size_t size);
+	// Copies the full state of one machine into a lane.
+	void load_lane(size_t lane, const Chip8& machine);
+
+	void seed(size_t lane, uint64_t value) {
+		rng[lane].seed(value);
+	}
+	void set_keys(size_t lane, uint16_t mask) {
+		keys[lane] = mask;
+	}
+	// Applies to every lane, as Chip8::set_sprite_edge.
+	void set_sprite_edge(SpriteEdge edge) {
+		sprite_edge = edge;
+	}
+
+	// Runs `cycles` instructions on every lane.
+	void step(unsigned int cycles);
+	// Same result as step(), for lanes that mostly share a pc (same ROM, similar input). Each cycle the
+	// lanes at the majority pc execute that opcode together with SSE2/AVX2 over the register arrays;
+	// divergent lanes, and opcodes without a vector form, run through the scalar path.
+	void step_lockstep(unsigned int cycles);
+	void tick_timers();
+
+	const uint64_t* get_video(size_t lane) const {
+		return &video[lane * VIDEO_HEIGHT];
+	}
+	uint8_t get_register(size_t lane, uint8_t reg) const {
+		return V[reg][lane];
+	}
+	uint16_t get_pc(size_t lane) const {
+		return pc[lane];
+	}
+	uint16_t get_index(size_t lane) const {
+		return index[lane];
+	}
+
+private:
+	// Minimum number of lanes at one pc before vector execution is worth the masking.
+	static const size_t MIN_GROUP = 8;
+
+	size_t count;
+	// count rounded up to the widest vector, so vector loads never run off the register arrays.
+	size_t padded;
+
+	std::vector<uint8_t> V[REGISTER_COUNT];
+	std::vector<uint16_t> index;
+	std::vector<uint16_t> pc;
+	std::vector<uint16_t> stack[STACK_LEVELS];
+	std::vector<uint8_t> sp;
+	std::vector<uint8_t> delay_timer;
+	std::vector<uint8_t> sound_timer;
+	std::vector<uint16_t> keys;
+	std::vector<Chip8Rng> rng;
+	SpriteEdge sprite_edge = SpriteEdge::Clip;
+
+	// lane * MEMORY_SIZE and lane * VIDEO_HEIGHT
+	std::vector<uint8_t> memory;
+	std::vector<uint64_t> video;
+
+	// Addresses any lane has written since load_rom(). Elsewhere every lane still holds the same
+	// code, so lockstep grouping only has to compare opcodes per lane at written addresses.
+	std::vector<uint8_t> written;
+	// Scratch byte masks for step_lockstep, 0xFF per selected lane.
+	std::vector<uint8_t> group;
+	std::vector<uint8_t> skip;
+
+	// One lane's registers pulled out of the arrays for the duration of a step.
+	struct Lane {
+		uint8_t V[REGISTER_COUNT];
+		uint16_t index;
+		uint16_t pc;
+		uint16_t stack[STACK_LEVELS];
+		uint8_t sp;
+		uint8_t delay_timer;
+		uint8_t sound_timer;
+		uint16_t keys;
+		Chip8Rng rng;
+		uint8_t* memory;
+		uint64_t* video;
+		uint8_t* written;
+		SpriteEdge sprite_edge;
+	};
+
+	void boot_lanes(const Chip8& boot);
+	void gather(size_t lane, Lane& state);
+	void scatter(size_t lane, const Lane& state);
+	static void execute(Lane& lane);
+	void execute_lane(size_t lane);
+	bool execute_group(uint16_t group_pc, uint16_t opcode);
+	uint16_t fetch(size_t lane) const;
+};
+
+#endif // !BATCH
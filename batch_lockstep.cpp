@@ -0,0 +1,380 @@
+#include "batch.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BATCH_SSE2
+#endif
+
+namespace {
+
+// Byte-wise operations over one vector of lanes. Masks are 0xFF per selected lane.
+#if defined(__AVX2__)
+typedef __m256i Vec;
+const size_t VEC_WIDTH = 32;
+
+inline Vec load(const uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline void store(uint8_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+inline Vec splat(uint8_t value) { return _mm256_set1_epi8(static_cast<char>(value)); }
+inline Vec add(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm256_sub_epi8(a, b); }
+inline Vec and_(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+inline Vec or_(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec xor_(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+inline Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vec max_u(Vec a, Vec b) { return _mm256_max_epu8(a, b); }
+inline Vec select(Vec mask, Vec a, Vec b) { return _mm256_blendv_epi8(b, a, mask); }
+inline Vec shr1(Vec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), splat(0x7F)); }
+inline Vec shr7(Vec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 7), splat(0x01)); }
+#elif defined(BATCH_SSE2)
+typedef __m128i Vec;
+const size_t VEC_WIDTH = 16;
+
+inline Vec load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline void store(uint8_t* p, Vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+inline Vec splat(uint8_t value) { return _mm_set1_epi8(static_cast<char>(value)); }
+inline Vec add(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+inline Vec and_(Vec a, Vec b) { return _mm_and_si128(a, b); }
+inline Vec or_(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec xor_(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+inline Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+inline Vec max_u(Vec a, Vec b) { return _mm_max_epu8(a, b); }
+inline Vec select(Vec mask, Vec a, Vec b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+inline Vec shr1(Vec a) { return _mm_and_si128(_mm_srli_epi16(a, 1), splat(0x7F)); }
+inline Vec shr7(Vec a) { return _mm_and_si128(_mm_srli_epi16(a, 7), splat(0x01)); }
+#else
+// Portable fallback; plain loops the compiler is free to vectorise.
+struct Vec {
+	uint8_t b[16];
+};
+const size_t VEC_WIDTH = 16;
+
+template <typename Op>
+inline Vec map(Vec a, Vec b, Op op)
+{
+	Vec r;
+	for (size_t i = 0; i < VEC_WIDTH; i++)
+		r.b[i] = static_cast<uint8_t>(op(a.b[i], b.b[i]));
+	return r;
+}
+
+inline Vec load(const uint8_t* p) { Vec v; memcpy(v.b, p, VEC_WIDTH); return v; }
+inline void store(uint8_t* p, Vec v) { memcpy(p, v.b, VEC_WIDTH); }
+inline Vec splat(uint8_t value) { Vec v; memset(v.b, value, VEC_WIDTH); return v; }
+inline Vec add(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l + r; }); }
+inline Vec sub(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l - r; }); }
+inline Vec and_(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l & r; }); }
+inline Vec or_(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l | r; }); }
+inline Vec xor_(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l ^ r; }); }
+inline Vec eq(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l == r ? 0xFF : 0x00; }); }
+inline Vec max_u(Vec a, Vec b) { return map(a, b, [](uint8_t l, uint8_t r) { return l > r ? l : r; }); }
+inline Vec select(Vec mask, Vec a, Vec b) { return or_(and_(mask, a), and_(xor_(mask, splat(0xFF)), b)); }
+inline Vec shr1(Vec a) { return map(a, a, [](uint8_t l, uint8_t) { return l >> 1; }); }
+inline Vec shr7(Vec a) { return map(a, a, [](uint8_t l, uint8_t) { return l >> 7; }); }
+#endif
+
+inline Vec not_(Vec a) { return xor_(a, splat(0xFF)); }
+// Unsigned a > b.
+inline Vec gt_u(Vec a, Vec b) { return not_(eq(max_u(a, b), b)); }
+
+}
+
+void Chip8Batch::step_lockstep(unsigned int cycles)
+{
+	for (unsigned int c = 0; c < cycles; c++) {
+		// Lanes running in step all share one pc, which is cheap to check before voting.
+		uint16_t differ = 0;
+		for (size_t lane = 0; lane < count; lane++)
+			differ |= pc[lane] ^ pc[0];
+
+		uint16_t leader = pc[0];
+		if (differ) {
+			// Boyer-Moore majority vote; whatever wins is some lane's pc even without a true majority.
+			size_t votes = 0;
+			for (size_t lane = 0; lane < count; lane++) {
+				if (votes == 0) {
+					leader = pc[lane];
+					votes = 1;
+				}
+				else if (pc[lane] == leader) {
+					votes++;
+				}
+				else {
+					votes--;
+				}
+			}
+		}
+
+		size_t first = 0;
+		while (pc[first] != leader)
+			first++;
+		uint16_t opcode = fetch(first);
+
+		// Unwritten code is identical in every lane; elsewhere the lanes have to agree on the opcode.
+		bool compare = written[leader & 0xFFFu] || written[(leader + 1) & 0xFFFu];
+		size_t members = count;
+		if (differ || compare) {
+			members = 0;
+			for (size_t lane = 0; lane < count; lane++) {
+				bool member = pc[lane] == leader && (!compare || fetch(lane) == opcode);
+				group[lane] = member ? 0xFF : 0x00;
+				members += member;
+			}
+		}
+		else {
+			memset(&group[0], 0xFF, count);
+		}
+
+		// Too scattered to be worth regrouping every instruction: finish lane by lane.
+		if (members < MIN_GROUP || members * 2 < count) {
+			step(cycles - c);
+			return;
+		}
+
+		bool grouped = execute_group(leader, opcode);
+		for (size_t lane = 0; lane < count; lane++) {
+			if (!grouped || !group[lane])
+				execute_lane(lane);
+		}
+	}
+}
+
+uint16_t Chip8Batch::fetch(size_t lane) const
+{
+	const uint8_t* mem = &memory[lane * MEMORY_SIZE];
+	return (mem[pc[lane] & 0xFFFu] << 8) | mem[(pc[lane] + 1) & 0xFFFu];
+}
+
+void Chip8Batch::execute_lane(size_t lane)
+{
+	Lane state;
+	gather(lane, state);
+	execute(state);
+	scatter(lane, state);
+}
+
+// Runs one opcode on every lane in `group`, with the same reads and writes as execute(). Returns false,
+// touching nothing, for opcodes that are left to the scalar path.
+bool Chip8Batch::execute_group(uint16_t group_pc, uint16_t opcode)
+{
+	uint8_t x = (opcode & 0x0F00u) >> 8u;
+	uint8_t y = (opcode & 0x00F0u) >> 4u;
+	uint8_t n = opcode & 0x000Fu;
+	uint8_t kk = opcode & 0x00FFu;
+	uint16_t nnn = opcode & 0x0FFFu;
+
+	uint8_t* Vx = &V[x][0];
+	uint8_t* Vy = &V[y][0];
+	uint8_t* VF = &V[0xF][0];
+	const uint8_t* mask = &group[0];
+
+	uint16_t target = group_pc + 2;
+	bool skips = false;
+	// Set by the opcodes that leave pc per lane themselves.
+	bool jumped = false;
+
+	// Opcodes touching per-lane memory, display, stack or timers loop over the group in scalar code,
+	// which still avoids gathering each lane's whole register file.
+	switch ((opcode & 0xF000u) >> 12u) {
+	case 0x0:
+		if (n == 0x0) {
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					memset(&video[lane * VIDEO_HEIGHT], 0, VIDEO_HEIGHT * sizeof(uint64_t));
+			}
+		}
+		else if (n == 0xE) {
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane]) {
+					sp[lane]--;
+					pc[lane] = stack[sp[lane] & 0xFu][lane];
+				}
+			}
+			jumped = true;
+		}
+		break;
+	case 0x1:
+		target = nnn;
+		break;
+	case 0x2:
+		for (size_t lane = 0; lane < count; lane++) {
+			if (group[lane]) {
+				stack[sp[lane] & 0xFu][lane] = group_pc + 2;
+				sp[lane]++;
+			}
+		}
+		target = nnn;
+		break;
+	case 0x3:
+	case 0x4:
+	case 0x5:
+	case 0x9: {
+		uint8_t family = (opcode & 0xF000u) >> 12u;
+		for (size_t i = 0; i < padded; i += VEC_WIDTH) {
+			Vec equal = eq(load(Vx + i), family == 0x3 || family == 0x4 ? splat(kk) : load(Vy + i));
+			store(&skip[i], and_(load(mask + i), family == 0x3 || family == 0x5 ? equal : not_(equal)));
+		}
+		skips = true;
+		break;
+	}
+	case 0x6:
+		for (size_t i = 0; i < padded; i += VEC_WIDTH)
+			store(Vx + i, select(load(mask + i), splat(kk), load(Vx + i)));
+		break;
+	case 0x7:
+		for (size_t i = 0; i < padded; i += VEC_WIDTH) {
+			Vec vx = load(Vx + i);
+			store(Vx + i, select(load(mask + i), add(vx, splat(kk)), vx));
+		}
+		break;
+	case 0x8:
+		// VF is stored before Vx is reloaded, so x or y being F behaves as in the handlers.
+		for (size_t i = 0; i < padded; i += VEC_WIDTH) {
+			Vec g = load(mask + i);
+			Vec vx = load(Vx + i);
+			Vec vy = load(Vy + i);
+
+			switch (n) {
+			case 0x0:
+				store(Vx + i, select(g, vy, vx));
+				break;
+			case 0x1:
+				store(Vx + i, select(g, or_(vx, vy), vx));
+				break;
+			case 0x2:
+				store(Vx + i, select(g, and_(vx, vy), vx));
+				break;
+			case 0x3:
+				store(Vx + i, select(g, xor_(vx, vy), vx));
+				break;
+			case 0x4: {
+				Vec sum = add(vx, vy);
+				store(VF + i, select(g, and_(gt_u(vx, sum), splat(1)), load(VF + i)));
+				store(Vx + i, select(g, sum, load(Vx + i)));
+				break;
+			}
+			case 0x5:
+				store(VF + i, select(g, and_(gt_u(vx, vy), splat(1)), load(VF + i)));
+				vx = load(Vx + i);
+				store(Vx + i, select(g, sub(vx, load(Vy + i)), vx));
+				break;
+			case 0x6:
+				store(VF + i, select(g, and_(vx, splat(1)), load(VF + i)));
+				vx = load(Vx + i);
+				store(Vx + i, select(g, shr1(vx), vx));
+				break;
+			case 0x7:
+				store(VF + i, select(g, and_(gt_u(vy, vx), splat(1)), load(VF + i)));
+				vx = load(Vx + i);
+				store(Vx + i, select(g, sub(load(Vy + i), vx), vx));
+				break;
+			case 0xE:
+				store(VF + i, select(g, shr7(vx), load(VF + i)));
+				vx = load(Vx + i);
+				store(Vx + i, select(g, add(vx, vx), vx));
+				break;
+			default:
+				return false;
+			}
+		}
+		break;
+	case 0xA:
+		for (size_t lane = 0; lane < count; lane++) {
+			if (group[lane])
+				index[lane] = nnn;
+		}
+		break;
+	case 0xB:
+		for (size_t lane = 0; lane < count; lane++) {
+			if (group[lane])
+				pc[lane] = V[0][lane] + nnn;
+		}
+		jumped = true;
+		break;
+	case 0xC:
+		for (size_t lane = 0; lane < count; lane++) {
+			if (group[lane])
+				Vx[lane] = rng[lane].next_byte() & kk;
+		}
+		break;
+	case 0xD:
+		for (size_t lane = 0; lane < count; lane++) {
+			if (!group[lane])
+				continue;
+			uint32_t changed = 0;
+			VF[lane] = blit_sprite(&video[lane * VIDEO_HEIGHT], &memory[lane * MEMORY_SIZE], index[lane],
+				Vx[lane] % VIDEO_WIDTH, Vy[lane] % VIDEO_HEIGHT, n, sprite_edge, changed);
+		}
+		break;
+	case 0xE:
+		if (n != 0xE && n != 0x1)
+			break;
+		for (size_t lane = 0; lane < count; lane++) {
+			bool pressed = (keys[lane] & (1u << (Vx[lane] & 0xFu))) != 0;
+			skip[lane] = group[lane] && pressed == (n == 0xE) ? 0xFF : 0x00;
+		}
+		skips = true;
+		break;
+	case 0xF:
+		switch (kk) {
+		case 0x07:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					Vx[lane] = delay_timer[lane];
+			}
+			break;
+		case 0x15:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					delay_timer[lane] = Vx[lane];
+			}
+			break;
+		case 0x18:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					sound_timer[lane] = Vx[lane];
+			}
+			break;
+		case 0x1E:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					index[lane] += Vx[lane];
+			}
+			break;
+		case 0x29:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (group[lane])
+					index[lane] = FONTSET_START_ADDRESS + (5 * Vx[lane]);
+			}
+			break;
+		case 0x65:
+			for (size_t lane = 0; lane < count; lane++) {
+				if (!group[lane])
+					continue;
+				const uint8_t* mem = &memory[lane * MEMORY_SIZE];
+				for (uint8_t i = 0; i <= x; i++)
+					V[i][lane] = mem[(index[lane] + i) & 0xFFFu];
+			}
+			break;
+		default:
+			// FX0A and the stores, which also have to track written code.
+			return false;
+		}
+		break;
+	default:
+		return false;
+	}
+
+	if (jumped)
+		return true;
+
+	for (size_t lane = 0; lane < count; lane++) {
+		if (group[lane])
+			pc[lane] = skips ? target + (skip[lane] & 2) : target;
+	}
+
+	return true;
+}
@@ -0,0 +1,68 @@
+#ifndef BLIT
+#define BLIT
+#include <cstdint>
+
+// What DXYN does with the parts of a sprite past the right or bottom edge of the display.
+enum class SpriteEdge {
+	Clip,
+	Wrap
+};
+
+// Each sprite row is one shifted 64-bit word, so a row costs one AND for collision and one XOR however it
+// straddles the byte grid. The edge mode is a template parameter, so the row loop carries no edge tests:
+// clipping only shortens the loop, and wrapping masks the row index and rotates instead of shifting.
+template <bool Wrap>
+inline uint8_t blit_rows(uint64_t* video, const uint8_t* memory, uint16_t address, unsigned int x, unsigned int y,
+	unsigned int height, uint32_t& changed)
+{
+	unsigned int rows = Wrap || y + height <= 32u ? height : 32u - y;
+	// Shifting left by (64 - x) & 63 brings the pixels pushed off the right back in on the left; at x = 0
+	// it repeats the unshifted row, which the OR absorbs.
+	unsigned int back = (64u - x) & 63u;
+
+	uint64_t collision = 0;
+	uint32_t drawn = 0;
+
+	for (unsigned int row = 0; row < rows; row++) {
+		uint64_t bits = static_cast<uint64_t>(memory[(address + row) & 0xFFFu]) << 56u;
+		uint64_t line = Wrap ? (bits >> x) | (bits << back) : bits >> x;
+
+		uint64_t& word = video[(y + row) & 31u];
+		collision |= word & line;
+		word ^= line;
+		drawn |= static_cast<uint32_t>(line != 0) << row;
+	}
+
+	// drawn is relative to y; rotating it into place also lands wrapped rows at the top.
+	changed |= y ? (drawn << y) | (drawn >> (32u - y)) : drawn;
+	return collision ? 1 : 0;
+}
+
+// XORs a `height`-row sprite read from memory[address...] into a framebuffer of 32 rows, one word per row
+// with bit 63 as the leftmost pixel, at (x, y) already reduced to the display. Returns the new VF, and ors
+// the rows whose pixels changed into `changed`.
+inline uint8_t blit_sprite(uint64_t* video, const uint8_t* memory, uint16_t address, uint8_t x, uint8_t y, uint8_t height,
+	SpriteEdge edge, uint32_t& changed)
+{
+	if (edge == SpriteEdge::Wrap)
+		return blit_rows<true>(video, memory, address, x, y, height, changed);
+	return blit_rows<false>(video, memory, address, x, y, height, changed);
+}
+
+// Whether blit_sprite with the same arguments would change any pixel. A sprite that changes none also
+// collides with none, so a caller can skip the blit and leave VF 0 without writing to the framebuffer.
+inline bool sprite_draws(const uint8_t* memory, uint16_t address, uint8_t x, uint8_t y, uint8_t height, SpriteEdge edge)
+{
+	bool wrap = edge == SpriteEdge::Wrap;
+	unsigned int rows = wrap || y + height <= 32u ? height : 32u - y;
+	// Clipped past x = 56, only the high bits of each row stay on the display.
+	unsigned int visible = wrap || x <= 56u ? 0xFFu : 0xFFu << (x - 56u);
+
+	for (unsigned int row = 0; row < rows; row++) {
+		if (memory[(address + row) & 0xFFFu] & visible)
+			return true;
+	}
+	return false;
+}
+
+#endif // !BLIT
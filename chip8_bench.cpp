@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdint.h>
+#include "cpu.h"
+#include "jit.h"
+#include "batch.h"
+
+// Benchmark harness: runs the bundled ROMs and synthetic opcode-mix kernels for a fixed number of
+// instructions on each dispatch engine and reports throughput as JSON, so builds can be compared over time.
+
+static void usage() {
+    std::cerr << "usage: chip8-bench [--instructions N] [--engines interp,jit,batch,lockstep] [--roms DIR] [--lanes N] [--repeat N] [--out FILE.json]" << std::endl;
+}
+
+struct Workload {
+    std::string name;
+    std::vector<uint8_t> rom;
+};
+
+// Each kernel loops forever over one opcode class, so its ns/instruction is that class's dispatch cost.
+static std::vector<Workload> kernels() {
+    return {
+        // 8XY* arithmetic and shifts, 7XKK.
+        { "kernel_alu", { 0x60, 0x01, 0x61, 0x02, 0x80, 0x14, 0x81, 0x25, 0x82, 0x06, 0x83, 0x0E, 0x82, 0x31, 0x83, 0x02,
+            0x84, 0x53, 0x74, 0x01, 0x12, 0x04 } },
+        // 3XKK/4XKK skips, 2NNN/00EE calls and 1NNN jumps.
+        { "kernel_branch", { 0x60, 0x00, 0x70, 0x01, 0x30, 0x00, 0x61, 0x00, 0x40, 0x00, 0x61, 0x00, 0x22, 0x12, 0x12, 0x02,
+            0x00, 0x00, 0x00, 0xEE } },
+        // DXYN with a 5-row font sprite at moving positions, edges included.
+        { "kernel_draw", { 0x60, 0x00, 0x61, 0x00, 0xA0, 0x50, 0xD0, 0x15, 0x70, 0x03, 0x71, 0x02, 0x12, 0x04 } },
+        // FX33/FX55/FX65 against a buffer at 0x300.
+        { "kernel_memory", { 0xA3, 0x00, 0xF0, 0x33, 0xF3, 0x55, 0xF3, 0x65, 0x70, 0x01, 0x12, 0x02 } },
+        // Timers, CXKK and the key skips.
+        { "kernel_timers", { 0xF0, 0x15, 0xF0, 0x07, 0xF1, 0x18, 0xC0, 0xFF, 0xE1, 0x9E, 0xE1, 0xA1, 0x71, 0x01, 0x12, 0x00 } },
+    };
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Timers tick every RATE instructions, as chip8-run does by default, so ROMs get past their delays.
+const uint64_t RATE = 10;
+
+// Returns the best wall time of `repeat` runs of `run`, each on a freshly booted machine from `setup`.
+static double best_of(unsigned int repeat, const std::function<std::function<void()>()>& setup) {
+    double best = 0;
+    for (unsigned int i = 0; i < repeat; i++) {
+        std::function<void()> run = setup();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+static double time_engine(const std::string& engine, const Workload& work, uint64_t instructions, size_t lanes, unsigned int repeat) {
+    if (engine == "interp" || engine == "jit") {
+        bool use_jit = engine == "jit";
+        return best_of(repeat, [&]() -> std::function<void()> {
+            std::shared_ptr<Chip8> chip8(new Chip8(1));
+            chip8->LoadROM(work.rom.data(), work.rom.size());
+            std::shared_ptr<Chip8Jit> jit(use_jit ? new Chip8Jit(*chip8) : nullptr);
+
+            return [=]() {
+                for (uint64_t done = 0; done < instructions; done += RATE) {
+                    if (jit) {
+                        jit->run(RATE);
+                    }
+                    else {
+                        for (uint64_t i = 0; i < RATE; i++)
+                            chip8->cycle();
+                    }
+                    chip8->tick_timers();
+                }
+            };
+        });
+    }
+
+    // Batch engines run `instructions` in total, spread over the lanes.
+    bool lockstep = engine == "lockstep";
+    uint64_t per_lane = instructions / lanes / RATE * RATE;
+    return best_of(repeat, [&]() -> std::function<void()> {
+        std::shared_ptr<Chip8Batch> batch(new Chip8Batch(lanes));
+        batch->load_rom(work.rom.data(), work.rom.size());
+        for (size_t lane = 0; lane < lanes; lane++)
+            batch->seed(lane, 1);
+
+        return [=]() {
+            for (uint64_t done = 0; done < per_lane; done += RATE) {
+                if (lockstep)
+                    batch->step_lockstep(RATE);
+                else
+                    batch->step(RATE);
+                batch->tick_timers();
+            }
+        };
+    });
+}
+
+// Executed opcodes by high nibble, from the trace of an interpreter run.
+static void opcode_mix(const Workload& work, uint64_t instructions, uint64_t counts[16]) {
+    Chip8 chip8(1);
+    chip8.LoadROM(work.rom.data(), work.rom.size());
+    chip8.set_tracing(true);
+
+    for (uint64_t done = 0; done < instructions; done += RATE) {
+        for (uint64_t i = 0; i < RATE; i++) {
+            chip8.cycle();
+            counts[chip8.trace_at(chip8.trace_size() - 1).opcode >> 12u]++;
+        }
+        chip8.tick_timers();
+    }
+}
+
+int main(int argc, char* args[]) {
+    uint64_t instructions = 10000000;
+    std::string engine_list = "interp,jit,batch,lockstep";
+    std::string rom_dir = "roms";
+    unsigned long lanes = 64;
+    unsigned long repeat = 3;
+    const char* out_file = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(args[i], "--instructions") && i + 1 < argc)
+            instructions = strtoull(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--engines") && i + 1 < argc)
+            engine_list = args[++i];
+        else if (!strcmp(args[i], "--roms") && i + 1 < argc)
+            rom_dir = args[++i];
+        else if (!strcmp(args[i], "--lanes") && i + 1 < argc)
+            lanes = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--repeat") && i + 1 < argc)
+            repeat = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--out") && i + 1 < argc)
+            out_file = args[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    // Whole frames only, and at least one frame per lane.
+    instructions -= instructions % RATE;
+    if (instructions < RATE * lanes || lanes == 0 || repeat == 0) {
+        usage();
+        return 1;
+    }
+
+    std::vector<std::string> engines;
+    std::istringstream names(engine_list);
+    for (std::string name; std::getline(names, name, ',');) {
+        if (name != "interp" && name != "jit" && name != "batch" && name != "lockstep") {
+            std::cerr << "Unknown engine: " << name << std::endl;
+            return 1;
+        }
+        engines.push_back(name);
+    }
+
+    std::vector<Workload> workloads;
+    for (const char* rom : { "pong", "invaders", "test_opcode", "test_audio" }) {
+        Workload work{ rom, {} };
+        if (!read_file(rom_dir + "/" + rom + ".ch8", work.rom)) {
+            std::cerr << "Could not load ROM: " << rom_dir << "/" << rom << ".ch8" << std::endl;
+            return 1;
+        }
+        workloads.push_back(work);
+    }
+    for (const Workload& kernel : kernels())
+        workloads.push_back(kernel);
+
+    {
+        Chip8 probe(1);
+        Chip8Jit jit(probe);
+        if (!jit.available())
+            std::cerr << "JIT not available on this host; the jit engine interprets" << std::endl;
+    }
+
+    std::ofstream file;
+    if (out_file) {
+        file.open(out_file);
+        if (!file.is_open()) {
+            std::cerr << "Could not write results to " << out_file << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = out_file ? file : std::cout;
+
+    out << "{\n  \"instructions\": " << instructions << ",\n  \"lanes\": " << lanes << ",\n  \"repeat\": " << repeat << ",\n  \"workloads\": [\n";
+    for (size_t w = 0; w < workloads.size(); w++) {
+        const Workload& work = workloads[w];
+        out << "    {\n      \"name\": \"" << work.name << "\",\n      \"engines\": {\n";
+
+        for (size_t e = 0; e < engines.size(); e++) {
+            uint64_t executed = engines[e] == "interp" || engines[e] == "jit" ? instructions : instructions / lanes / RATE * RATE * lanes;
+            double seconds = time_engine(engines[e], work, instructions, lanes, repeat);
+            out << "        \"" << engines[e] << "\": { \"instructions\": " << executed << ", \"seconds\": " << seconds
+                << ", \"instructions_per_second\": " << static_cast<uint64_t>(seconds > 0 ? executed / seconds : 0)
+                << ", \"ns_per_instruction\": " << seconds * 1e9 / executed << " }" << (e + 1 < engines.size() ? "," : "") << "\n";
+            std::cerr << work.name << " " << engines[e] << ": " << seconds * 1e9 / executed << " ns/instruction" << std::endl;
+        }
+
+        // Where the instructions go, so a change in a class's cost can be weighed against how often it runs.
+        uint64_t counts[16]{};
+        uint64_t sampled = std::min<uint64_t>(instructions, 1000000);
+        opcode_mix(work, sampled, counts);
+        out << "      },\n      \"opcode_mix\": {";
+        for (unsigned int c = 0; c < 16; c++)
+            out << (c ? ", " : " ") << "\"" << std::hex << std::uppercase << c << "xxx" << std::dec << "\": " << static_cast<double>(counts[c]) / sampled;
+        out << " }\n    }" << (w + 1 < workloads.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+
+    return out.good() ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdint.h>
+#include "explore.h"
+
+// Exploration runner: searches a ROM's reachable states with random input and reports the archive of cells
+// found, optionally as one replayable movie per cell.
+
+static void usage() {
+    std::cerr << "usage: chip8-explore <rom> [--steps N] [--seconds S] [--frames N] [--rate CYCLES_PER_FRAME] [--hold FRAMES] [--keys HEX_MASK] [--block WxH] [--levels N] [--watch ADDR[,ADDR...]] [--seed N] [--threads N] [--cells FILE.csv] [--movies DIR]" << std::endl;
+}
+
+static bool parse_watch(const char* list, std::vector<uint16_t>& watch) {
+    while (*list) {
+        char* end = nullptr;
+        unsigned long address = strtoul(list, &end, 0);
+        if (end == list || address >= MEMORY_SIZE || (*end && *end != ','))
+            return false;
+        watch.push_back(static_cast<uint16_t>(address));
+        list = *end ? end + 1 : end;
+    }
+    return !watch.empty();
+}
+
+static void write_cells(std::ostream& out, const Explorer& explorer, const std::vector<uint16_t>& watch) {
+    out << "cell,key,frames,chosen,seen";
+    for (uint16_t address : watch)
+        out << ",mem_" << std::hex << std::setw(3) << std::setfill('0') << address << std::dec << std::setfill(' ');
+    out << "\n";
+
+    for (size_t i = 0; i < explorer.size(); i++) {
+        const ExploreCell& cell = explorer.cell(i);
+        out << i << "," << std::hex << std::setw(16) << std::setfill('0') << cell.key << std::dec << std::setfill(' ') << ","
+            << cell.frames << "," << cell.chosen << "," << cell.seen;
+        for (uint16_t address : watch)
+            out << "," << static_cast<unsigned int>(cell.state.get_memory(address));
+        out << "\n";
+    }
+}
+
+int main(int argc, char* args[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* cells_file = nullptr;
+    const char* movies_dir = nullptr;
+    uint64_t steps = 0;
+    double seconds = 0;
+    ExploreConfig config;
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(args[i], "--steps") && i + 1 < argc)
+            steps = strtoull(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--seconds") && i + 1 < argc)
+            seconds = strtod(args[++i], nullptr);
+        else if (!strcmp(args[i], "--frames") && i + 1 < argc)
+            config.frames = static_cast<unsigned int>(strtoul(args[++i], nullptr, 10));
+        else if (!strcmp(args[i], "--rate") && i + 1 < argc)
+            config.rate = static_cast<unsigned int>(strtoul(args[++i], nullptr, 10));
+        else if (!strcmp(args[i], "--hold") && i + 1 < argc)
+            config.hold = static_cast<unsigned int>(strtoul(args[++i], nullptr, 10));
+        else if (!strcmp(args[i], "--keys") && i + 1 < argc)
+            config.keys = static_cast<uint16_t>(strtoul(args[++i], nullptr, 16));
+        else if (!strcmp(args[i], "--block") && i + 1 < argc) {
+            char* end = nullptr;
+            config.block_width = static_cast<unsigned int>(strtoul(args[++i], &end, 10));
+            if (*end != 'x') {
+                usage();
+                return 1;
+            }
+            config.block_height = static_cast<unsigned int>(strtoul(end + 1, nullptr, 10));
+        }
+        else if (!strcmp(args[i], "--levels") && i + 1 < argc)
+            config.levels = static_cast<unsigned int>(strtoul(args[++i], nullptr, 10));
+        else if (!strcmp(args[i], "--watch") && i + 1 < argc) {
+            if (!parse_watch(args[++i], config.watch)) {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(args[i], "--seed") && i + 1 < argc)
+            config.seed = strtoull(args[++i], nullptr, 0);
+        else if (!strcmp(args[i], "--threads") && i + 1 < argc)
+            config.threads = static_cast<unsigned int>(strtoul(args[++i], nullptr, 10));
+        else if (!strcmp(args[i], "--cells") && i + 1 < argc)
+            cells_file = args[++i];
+        else if (!strcmp(args[i], "--movies") && i + 1 < argc)
+            movies_dir = args[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    // A time limit alone runs until it is up.
+    if (!steps)
+        steps = seconds > 0 ? std::numeric_limits<uint64_t>::max() : 10000;
+
+    Explorer explorer(config);
+    if (!explorer.load(args[1])) {
+        std::cerr << "Could not load ROM, or the settings are out of range: " << args[1] << std::endl;
+        return 1;
+    }
+
+    ExploreStats stats = explorer.run(steps, seconds);
+
+    std::cout << "cells: " << explorer.size() << std::endl;
+    std::cout << "steps: " << stats.steps << std::endl;
+    std::cout << "frames: " << stats.frames << std::endl;
+    std::cout << "threads: " << explorer.threads() << std::endl;
+    std::cout << "seconds: " << stats.seconds << std::endl;
+    if (stats.seconds > 0) {
+        std::cout << "frames/s: " << static_cast<uint64_t>(stats.frames / stats.seconds) << std::endl;
+        std::cout << "frames/s per thread: " << static_cast<uint64_t>(stats.frames / stats.seconds / explorer.threads()) << std::endl;
+        std::cout << "new cells/s: " << stats.new_cells / stats.seconds << std::endl;
+    }
+
+    // The furthest any watched byte got, and the first cell to get there.
+    for (uint16_t address : config.watch) {
+        size_t best = 0;
+        for (size_t i = 1; i < explorer.size(); i++) {
+            if (explorer.cell(i).state.get_memory(address) > explorer.cell(best).state.get_memory(address))
+                best = i;
+        }
+        std::cout << "max [" << std::hex << std::setw(3) << std::setfill('0') << address << std::dec << std::setfill(' ') << "]: "
+            << static_cast<unsigned int>(explorer.cell(best).state.get_memory(address)) << " (cell " << best << ", "
+            << explorer.cell(best).frames << " frames)" << std::endl;
+    }
+
+    if (cells_file) {
+        std::ofstream out(cells_file);
+        write_cells(out, explorer, config.watch);
+        if (!out.good()) {
+            std::cerr << "Could not write cells to " << cells_file << std::endl;
+            return 1;
+        }
+    }
+
+    if (movies_dir) {
+        for (size_t i = 0; i < explorer.size(); i++) {
+            std::string filename = std::string(movies_dir) + "/cell_" + std::to_string(i) + ".c8m";
+            if (!explorer.movie(i).save(filename.c_str())) {
+                std::cerr << "Could not write " << filename << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
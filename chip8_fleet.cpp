@@ -0,0 +1,166 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include "fleet.h"
+
+// Fleet runner: executes a list of headless jobs across every core and reports per-job results, or with
+// --scaling the throughput curve from one thread up to the full pool.
+
+static void usage() {
+    std::cerr << "usage: chip8-fleet <jobs.txt> [--threads N] [--rate CYCLES_PER_FRAME] [--results FILE.csv] [--scaling]" << std::endl;
+    std::cerr << "job lines: <rom> [seed] [cycles] [input script | -]" << std::endl;
+}
+
+static bool load_jobs(const char* filename, unsigned int rate, std::vector<FleetJob>& jobs) {
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        FleetJob job;
+        std::string seed, cycles, input;
+        if (!(fields >> job.rom))
+            continue;
+        if (fields >> seed)
+            job.seed = strtoull(seed.c_str(), nullptr, 0);
+        if (fields >> cycles)
+            job.cycles = strtoull(cycles.c_str(), nullptr, 10);
+        if (fields >> input && input != "-")
+            job.input = input;
+        job.rate = rate;
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static void write_results(std::ostream& out, const std::vector<FleetJob>& jobs, const std::vector<FleetResult>& results) {
+    out << "job,rom,seed,status,cycles,video_hash,seconds,worker\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const FleetResult& r = results[i];
+        out << i << "," << jobs[i].rom << "," << jobs[i].seed << "," << (r.ok ? "ok" : "error") << ","
+            << r.cycles << "," << std::hex << std::setw(16) << std::setfill('0') << r.video_hash << std::dec << std::setfill(' ') << ","
+            << r.seconds << "," << r.worker << "\n";
+    }
+}
+
+static uint64_t total_cycles(const std::vector<FleetResult>& results) {
+    uint64_t cycles = 0;
+    for (const FleetResult& r : results)
+        cycles += r.cycles;
+    return cycles;
+}
+
+static double timed_run(unsigned int threads, const std::vector<FleetJob>& jobs, std::vector<FleetResult>& results) {
+    Fleet fleet(threads);
+    auto start = std::chrono::steady_clock::now();
+    results = fleet.run(jobs);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* args[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* results_file = nullptr;
+    unsigned long threads = 0;
+    unsigned long rate = 10;
+    bool scaling = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(args[i], "--threads") && i + 1 < argc)
+            threads = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--rate") && i + 1 < argc)
+            rate = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--results") && i + 1 < argc)
+            results_file = args[++i];
+        else if (!strcmp(args[i], "--scaling"))
+            scaling = true;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (rate == 0) {
+        usage();
+        return 1;
+    }
+
+    std::vector<FleetJob> jobs;
+    if (!load_jobs(args[1], rate, jobs) || jobs.empty()) {
+        std::cerr << "Could not load jobs: " << args[1] << std::endl;
+        return 1;
+    }
+
+    unsigned int pool = Fleet(threads).threads();
+    std::vector<FleetResult> results;
+
+    if (scaling) {
+        // Doubling thread counts up to the pool size, each against the same jobs. Every run must agree on
+        // every framebuffer, or the jobs are not independent of scheduling.
+        std::vector<unsigned int> counts;
+        for (unsigned int t = 1; t < pool; t *= 2)
+            counts.push_back(t);
+        counts.push_back(pool);
+
+        std::vector<FleetResult> reference;
+        double base = 0;
+        std::cout << "threads,seconds,jobs/s,cycles/s,speedup,efficiency" << std::endl;
+        for (unsigned int t : counts) {
+            double seconds = timed_run(t, jobs, results);
+            if (t == 1) {
+                base = seconds;
+                reference = results;
+            }
+            for (size_t i = 0; i < jobs.size(); i++) {
+                if (results[i].video_hash != reference[i].video_hash) {
+                    std::cerr << "Job " << i << " differs between 1 and " << t << " threads" << std::endl;
+                    return 1;
+                }
+            }
+
+            double speedup = seconds > 0 ? base / seconds : 0;
+            std::cout << t << "," << seconds << "," << jobs.size() / seconds << "," << static_cast<uint64_t>(total_cycles(results) / seconds)
+                << "," << speedup << "," << speedup / t << std::endl;
+        }
+    }
+    else {
+        double seconds = timed_run(pool, jobs, results);
+        if (!results_file)
+            write_results(std::cout, jobs, results);
+
+        std::cerr << "jobs: " << jobs.size() << std::endl;
+        std::cerr << "threads: " << pool << std::endl;
+        std::cerr << "seconds: " << seconds << std::endl;
+        if (seconds > 0)
+            std::cerr << "cycles/s: " << static_cast<uint64_t>(total_cycles(results) / seconds) << std::endl;
+    }
+
+    // With --scaling these are the results of the full-pool run.
+    if (results_file) {
+        std::ofstream out(results_file);
+        write_results(out, jobs, results);
+        if (!out.good()) {
+            std::cerr << "Could not write results to " << results_file << std::endl;
+            return 1;
+        }
+    }
+
+    size_t failed = 0;
+    for (const FleetResult& r : results)
+        failed += !r.ok;
+    if (failed)
+        std::cerr << failed << " job(s) could not be loaded" << std::endl;
+
+    return failed ? 1 : 0;
+}
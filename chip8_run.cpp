@@ -0,0 +1,285 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include "cpu.h"
+#include "jit.h"
+#include "movie.h"
+
+// Headless runner: executes a ROM on the core alone, with no window, audio device or pacing.
+
+static void usage() {
+    std::cerr << "usage: chip8-run <rom> [--cycles N | --frames N] [--rate CYCLES_PER_FRAME] [--seed N] [--dump FILE.pbm] [--jit] [--no-idle-skip] [--wrap-sprites] [--load-state FILE] [--save-state FILE] [--replay FILE.c8m] [--profile FILE.json|FILE.csv] [--profile-sample N] [--heatmap FILE.csv] [--callgraph FILE.folded|FILE.csv] [--check-hash]" << std::endl;
+}
+
+static bool dump_video(const Chip8& chip8, const char* filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    file << "P4\n" << VIDEO_WIDTH << " " << VIDEO_HEIGHT << "\n";
+
+    // PBM rows are packed MSB first, the same layout as the core's framebuffer words.
+    const uint64_t* video = chip8.get_video();
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+        for (int shift = 56; shift >= 0; shift -= 8)
+            file.put(static_cast<char>((video[y] >> shift) & 0xFFu));
+    }
+
+    return file.good();
+}
+
+int main(int argc, char* args[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* rom = args[1];
+    const char* dump = nullptr;
+    const char* load_state = nullptr;
+    const char* save_state = nullptr;
+    const char* replay = nullptr;
+    const char* profile_file = nullptr;
+    const char* heatmap_file = nullptr;
+    const char* callgraph_file = nullptr;
+    unsigned long profile_sample = 0;
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    unsigned long rate = 10;
+    uint64_t seed = 0;
+    bool use_jit = false;
+    bool idle_skip = true;
+    bool wrap_sprites = false;
+    bool check_hash = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(args[i], "--cycles") && i + 1 < argc)
+            cycles = strtoull(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--frames") && i + 1 < argc)
+            frames = strtoull(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--rate") && i + 1 < argc)
+            rate = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--seed") && i + 1 < argc)
+            seed = strtoull(args[++i], nullptr, 0);
+        else if (!strcmp(args[i], "--dump") && i + 1 < argc)
+            dump = args[++i];
+        else if (!strcmp(args[i], "--load-state") && i + 1 < argc)
+            load_state = args[++i];
+        else if (!strcmp(args[i], "--save-state") && i + 1 < argc)
+            save_state = args[++i];
+        else if (!strcmp(args[i], "--replay") && i + 1 < argc)
+            replay = args[++i];
+        else if (!strcmp(args[i], "--profile") && i + 1 < argc)
+            profile_file = args[++i];
+        else if (!strcmp(args[i], "--profile-sample") && i + 1 < argc)
+            profile_sample = strtoul(args[++i], nullptr, 10);
+        else if (!strcmp(args[i], "--heatmap") && i + 1 < argc)
+            heatmap_file = args[++i];
+        else if (!strcmp(args[i], "--callgraph") && i + 1 < argc)
+            callgraph_file = args[++i];
+        else if (!strcmp(args[i], "--jit"))
+            use_jit = true;
+        else if (!strcmp(args[i], "--no-idle-skip"))
+            idle_skip = false;
+        else if (!strcmp(args[i], "--wrap-sprites"))
+            wrap_sprites = true;
+        else if (!strcmp(args[i], "--check-hash"))
+            check_hash = true;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    // One profile per run.
+    if (rate == 0 || (cycles && frames) || (!!profile_file + !!heatmap_file + !!callgraph_file > 1) || (replay && load_state)) {
+        usage();
+        return 1;
+    }
+
+    // A movie fixes the seed and frame rate, and runs to its end unless told otherwise.
+    Movie movie;
+    if (replay) {
+        uint64_t rom_hash = 0;
+        if (!movie.load(replay)) {
+            std::cerr << "Could not load movie: " << replay << std::endl;
+            return 1;
+        }
+        if (!Movie::hash_rom(rom, rom_hash) || rom_hash != movie.rom_hash) {
+            std::cerr << "Movie was recorded on a different ROM than " << rom << std::endl;
+            return 1;
+        }
+        seed = movie.seed;
+        rate = movie.cycles_per_frame;
+        if (!cycles && !frames)
+            cycles = movie.length;
+    }
+
+    // An empty movie runs nothing.
+    if (!cycles && (frames || !replay))
+        cycles = (frames ? frames : 600) * rate;
+
+    Chip8 chip8(seed);
+    chip8.set_sprite_edge(wrap_sprites ? SpriteEdge::Wrap : SpriteEdge::Clip);
+    chip8.set_hashing(check_hash);
+    chip8.set_tracing(check_hash);
+    if (!chip8.LoadROM(rom)) {
+        std::cerr << "Could not load ROM: " << rom << std::endl;
+        return 1;
+    }
+
+    if (load_state && !chip8.load_state(load_state)) {
+        std::cerr << "Could not load state: " << load_state << std::endl;
+        return 1;
+    }
+
+    Chip8Jit jit(chip8);
+    if (use_jit && !jit.available())
+        std::cerr << "JIT not available on this host, interpreting" << std::endl;
+
+    // The profiles hook the interpreter's dispatch, so profiling runs interpret.
+    if (use_jit && (profile_file || heatmap_file || callgraph_file)) {
+        std::cerr << "Profiling interprets; ignoring --jit" << std::endl;
+        use_jit = false;
+    }
+    OpcodeProfile profile(static_cast<unsigned int>(profile_sample));
+    AddressProfile heatmap;
+    CallProfile callgraph;
+
+    // Checks the running state hash against a full rehash, after every interpreted instruction and after
+    // every JIT batch, idle skip and timer tick. Slow: a rehash covers all of memory. The JIT doesn't trace,
+    // so only an interpreted instruction can be named.
+    auto hash_matches = [&](uint64_t at) {
+        if (chip8.state_hash() == chip8.full_hash())
+            return true;
+        std::cerr << "State hash diverged from a full rehash at cycle " << at;
+        if (!use_jit && chip8.trace_size()) {
+            Chip8::TraceEntry last = chip8.trace_at(chip8.trace_size() - 1);
+            std::cerr << std::hex << std::uppercase << std::setfill('0') << ", after " << std::setw(4) << last.opcode
+                << " at " << std::setw(3) << last.pc << std::dec;
+        }
+        std::cerr << std::endl;
+        return false;
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Timers tick once per frame of `rate` cycles, as they would at 60 Hz on the frontend. A frame is split
+    // wherever the movie changes the keys.
+    const std::vector<Movie::Event>& events = movie.get_events();
+    size_t next_event = 0;
+    uint64_t executed = 0;
+    uint64_t idle = 0;
+    while (executed < cycles) {
+        while (next_event < events.size() && events[next_event].at <= executed)
+            chip8.set_keys(events[next_event++].keys);
+        uint64_t until = next_event < events.size() && events[next_event].at < cycles ? events[next_event].at : cycles;
+
+        uint64_t frame_left = rate - executed % rate;
+        uint64_t batch = until - executed < frame_left ? until - executed : frame_left;
+        uint64_t skipped = idle_skip ? chip8.skip_idle(batch) : 0;
+        if (use_jit) {
+            jit.run(batch - skipped);
+        }
+        else if (profile_file) {
+            for (uint64_t i = skipped; i < batch; i++)
+                chip8.cycle(profile);
+        }
+        else if (heatmap_file) {
+            for (uint64_t i = skipped; i < batch; i++)
+                chip8.cycle(heatmap);
+        }
+        else if (callgraph_file) {
+            for (uint64_t i = skipped; i < batch; i++)
+                chip8.cycle(callgraph);
+        }
+        else if (check_hash) {
+            for (uint64_t i = skipped; i < batch; i++) {
+                chip8.cycle();
+                if (!hash_matches(executed + i + 1))
+                    return 1;
+            }
+        }
+        else {
+            for (uint64_t i = skipped; i < batch; i++)
+                chip8.cycle();
+        }
+        executed += batch;
+        idle += skipped;
+
+        if (executed % rate == 0)
+            chip8.tick_timers();
+
+        // Keys change only at the next movie event, so a key wait or a jump to self lasts until then or the
+        // end of the run: jump the timers straight to the last whole frame before it.
+        Chip8::IdleState state = idle_skip && executed % rate == 0 ? chip8.idle_state() : Chip8::IdleState::None;
+        if (state == Chip8::IdleState::KeyWait || state == Chip8::IdleState::Halt) {
+            uint64_t frames_left = (until - executed) / rate;
+            chip8.tick_timers(frames_left);
+            executed += frames_left * rate;
+            idle += frames_left * rate;
+        }
+
+        if (check_hash && !hash_matches(executed))
+            return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "cycles: " << executed << std::endl;
+    std::cout << "frames: " << executed / rate << std::endl;
+    std::cout << "idle cycles skipped: " << idle << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    if (seconds > 0)
+        std::cout << "cycles/s: " << static_cast<uint64_t>(executed / seconds) << std::endl;
+    std::cout << "state hash: " << std::hex << std::setfill('0') << std::setw(16) << chip8.state_hash() << std::dec << std::endl;
+
+    if (save_state && !chip8.save_state(save_state)) {
+        std::cerr << "Could not write state to " << save_state << std::endl;
+        return 1;
+    }
+
+    if (profile_file) {
+        std::ofstream file(profile_file);
+        size_t length = strlen(profile_file);
+        if (length >= 4 && !strcmp(profile_file + length - 4, ".csv"))
+            profile.write_csv(file);
+        else
+            profile.write_json(file);
+        if (!file.good()) {
+            std::cerr << "Could not write profile to " << profile_file << std::endl;
+            return 1;
+        }
+    }
+
+    if (heatmap_file) {
+        std::ofstream file(heatmap_file);
+        heatmap.write_csv(file);
+        if (!file.good()) {
+            std::cerr << "Could not write heatmap to " << heatmap_file << std::endl;
+            return 1;
+        }
+    }
+
+    if (callgraph_file) {
+        std::ofstream file(callgraph_file);
+        size_t length = strlen(callgraph_file);
+        if (length >= 4 && !strcmp(callgraph_file + length - 4, ".csv"))
+            callgraph.write_csv(file);
+        else
+            callgraph.write_folded(file);
+        if (!file.good()) {
+            std::cerr << "Could not write call graph to " << callgraph_file << std::endl;
+            return 1;
+        }
+    }
+
+    if (dump && !dump_video(chip8, dump)) {
+        std::cerr << "Could not write framebuffer to " << dump << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
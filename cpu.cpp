@@ -1,9 +1,6 @@
 #include "cpu.h"
 #include <fstream>
-
-const unsigned int FONTSET_SIZE = 80;
-const unsigned int START_ADDRESS = 0x200;
-const unsigned int FONTSET_START_ADDRESS = 0x50;
+#include <cstring>
 
 uint8_t fontset[FONTSET_SIZE] = {
 	0xF0, 0x90, 0x90, 0x90, 0xF0,
@@ -24,15 +21,60 @@ uint8_t fontset[FONTSET_SIZE] = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80
 };
 
-Chip8::Chip8() : rand_gen(std::chrono::system_clock::now().time_since_epoch().count()) {
+namespace {
+
+// Zobrist keys, computed rather than tabled: 4096 x 256 of them would take 8 MB.
+uint64_t memory_key(unsigned int address, uint8_t value)
+{
+	return splitmix64(((address & 0xFFFu) << 8u | value) + 0x9E3779B97F4A7C15ull);
+}
+
+uint64_t video_key(unsigned int row, uint64_t word)
+{
+	return splitmix64(word ^ (row + 1u) * 0x9E3779B97F4A7C15ull);
+}
+
+}
+
+Chip8::Chip8() : Chip8(std::chrono::system_clock::now().time_since_epoch().count()) {}
+
+Chip8::Chip8Func Chip8::table[0xF + 1];
+Chip8::Chip8Func Chip8::table0[0xE + 1];
+Chip8::Chip8Func Chip8::table8[0xE + 1];
+Chip8::Chip8Func Chip8::tableE[0xE + 1];
+Chip8::Chip8Func Chip8::tableF[0x65 + 1];
+
+Chip8::Chip8(uint64_t seed) : rng(seed) {
 	pc = START_ADDRESS;
 
-	for (unsigned int i = 0; i < FONTSET_SIZE; i++)
-		memory[FONTSET_START_ADDRESS + i] = fontset[i];
+	store(FONTSET_START_ADDRESS, fontset, FONTSET_SIZE);
+}
 
-	rand_byte = std::uniform_int_distribution<unsigned int>(0, 255U);
+Chip8::VideoPage::VideoPage(const VideoPage& other)
+{
+	memcpy(rows, other.rows, sizeof(rows));
+}
 
-	table[0x0] = &Chip8::Table0;
+Chip8::MemoryPage::MemoryPage()
+{
+	// Nothing decodes before the first page exists, so this is where the tables get filled, once.
+	static const bool filled = (fill_tables(), true);
+	(void)filled;
+
+	decode(0, decoded[0]);
+	for (auto& entry : decoded)
+		entry = decoded[0];
+}
+
+Chip8::MemoryPage::MemoryPage(const MemoryPage& other)
+{
+	memcpy(bytes, other.bytes, sizeof(bytes));
+	memcpy(decoded, other.decoded, sizeof(decoded));
+}
+
+void Chip8::fill_tables()
+{
+	// 0x0, 0x8, 0xE and 0xF are resolved through their sub-tables in decode().
 	table[0x1] = &Chip8::OP_1NNN;
 	table[0x2] = &Chip8::OP_2NNN;
 	table[0x3] = &Chip8::OP_3XKK;
@@ -40,14 +82,11 @@ Chip8::Chip8() : rand_gen(std::chrono::system_clock::now().time_since_epoch().co
 	table[0x5] = &Chip8::OP_5XY0;
 	table[0x6] = &Chip8::OP_6XKK;
 	table[0x7] = &Chip8::OP_7XKK;
-	table[0x8] = &Chip8::Table8;
 	table[0x9] = &Chip8::OP_9XY0;
 	table[0xA] = &Chip8::OP_ANNN;
 	table[0xB] = &Chip8::OP_BNNN;
 	table[0xC] = &Chip8::OP_CXKK;
 	table[0xD] = &Chip8::OP_DXYN;
-	table[0xE] = &Chip8::TableE;
-	table[0xF] = &Chip8::TableF;
 
 	for (size_t i = 0; i <= 0xE; i++)
 	{
@@ -88,48 +127,137 @@ Chip8::Chip8() : rand_gen(std::chrono::system_clock::now().time_since_epoch().co
 	tableF[0x65] = &Chip8::OP_FX65;
 }
 
-void Chip8::Table0()
+void Chip8::decode(uint16_t op, Instruction& entry)
+{
+	entry.opcode = op;
+	entry.nnn = op & 0x0FFFu;
+	entry.x = (op & 0x0F00u) >> 8u;
+	entry.y = (op & 0x00F0u) >> 4u;
+	entry.n = op & 0x000Fu;
+	entry.kk = op & 0x00FFu;
+
+	switch ((op & 0xF000u) >> 12u) {
+	case 0x0:
+		entry.func = entry.n <= 0xE ? table0[entry.n] : &Chip8::OP_NULL;
+		break;
+	case 0x8:
+		entry.func = entry.n <= 0xE ? table8[entry.n] : &Chip8::OP_NULL;
+		break;
+	case 0xE:
+		entry.func = entry.n <= 0xE ? tableE[entry.n] : &Chip8::OP_NULL;
+		break;
+	case 0xF:
+		entry.func = entry.kk <= 0x65 ? tableF[entry.kk] : &Chip8::OP_NULL;
+		break;
+	default:
+		entry.func = table[(op & 0xF000u) >> 12u];
+		break;
+	}
+}
+
+void Chip8::write(uint16_t address, const uint8_t* data, size_t size)
 {
-	((*this).*(table0[opcode & 0x000Fu]))();
+	while (size) {
+		address &= 0xFFFu;
+		unsigned int offset = address & 0xFFu;
+		size_t run = size < MEMORY_PAGE_SIZE - offset ? size : MEMORY_PAGE_SIZE - offset;
+
+		const uint8_t* bytes = memory[address >> 8u].get().bytes;
+		bool changed = memory[address >> 8u].unique();
+		for (size_t i = 0; !changed && i < run; i++)
+			changed = bytes[offset + i] != data[i];
+
+		if (changed) {
+			MemoryPage& page = writable(address >> 8u);
+			for (size_t i = 0; hashing && i < run; i++) {
+				if (page.bytes[offset + i] != data[i])
+					memory_hash ^= memory_key(static_cast<unsigned int>(address + i), page.bytes[offset + i])
+						^ memory_key(static_cast<unsigned int>(address + i), data[i]);
+			}
+			for (size_t i = 0; i < run; i++) {
+				page.bytes[offset + i] = data[i];
+				page.decoded[offset + i].func = nullptr;
+			}
+
+			// Each byte is also the low half of the instruction before it.
+			if (offset)
+				page.decoded[offset - 1].func = nullptr;
+			else
+				invalidate(address - 1u);
+		}
+
+		address += static_cast<uint16_t>(run);
+		data += run;
+		size -= run;
+	}
+}
+
+void Chip8::store(uint16_t address, const uint8_t* data, size_t size)
+{
+	write(address, data, size);
+
+	// Only entries write() cleared need decoding, and those are all in pages it made this machine's own.
+	for (size_t i = 0; i <= size && i < MEMORY_SIZE; i++) {
+		uint16_t at = (address - 1u + i) & 0xFFFu;
+		const Shared<MemoryPage>& page = memory[at >> 8u];
+		if (page.unique() && !page.get().decoded[at & 0xFFu].func)
+			decode_at(at);
+	}
 }
 
-void Chip8::Table8()
+const Chip8::Instruction* Chip8::decode_at(uint16_t address)
 {
-	((*this).*(table8[opcode & 0x000Fu]))();
+	address &= 0xFFFu;
+	Instruction& entry = writable(address >> 8u).decoded[address & 0xFFu];
+	decode(fetch(address), entry);
+	return &entry;
 }
 
-void Chip8::TableE()
+void Chip8::invalidate(uint16_t address)
 {
-	((*this).*(tableE[opcode & 0x000Fu]))();
+	// An entry already clear needn't cost a copy of its page.
+	address &= 0xFFFu;
+	if (memory[address >> 8u].get().decoded[address & 0xFFu].func)
+		writable(address >> 8u).decoded[address & 0xFFu].func = nullptr;
 }
 
-void Chip8::TableF()
+void Chip8::copy_memory(uint8_t* out) const
 {
-	((*this).*(tableF[opcode & 0x00FFu]))();
+	for (unsigned int page = 0; page < MEMORY_PAGES; page++)
+		memcpy(out + page * MEMORY_PAGE_SIZE, memory[page].get().bytes, MEMORY_PAGE_SIZE);
 }
 
 void Chip8::OP_NULL()
 {}
 
-void Chip8::LoadROM(char const* filename)
+bool Chip8::LoadROM(char const* filename)
 {
 	std::ifstream file(filename, std::ios::binary | std::ios::ate);
 
 	if (file.is_open())
 	{
 		std::streampos size = file.tellg();
-		char* buffer = new char[size];
+		if (size > static_cast<std::streampos>(MEMORY_SIZE - START_ADDRESS))
+			return false;
+
+		std::vector<uint8_t> buffer(static_cast<size_t>(size));
 		file.seekg(0, std::ios::beg);
-		file.read(buffer, size);
+		file.read(reinterpret_cast<char*>(buffer.data()), size);
 		file.close();
 
-		for (long i = 0; i < size; ++i)
-		{
-			memory[START_ADDRESS + i] = buffer[i];
-		}
-
-		delete[] buffer;
+		return LoadROM(buffer.data(), buffer.size());
 	}
+
+	return false;
+}
+
+bool Chip8::LoadROM(const uint8_t* data, size_t size)
+{
+	if (size > MEMORY_SIZE - START_ADDRESS)
+		return false;
+
+	store(START_ADDRESS, data, size);
+	return true;
 }
 
 std::string Chip8::get_opcode_string(uint16_t opcode)
@@ -146,19 +274,91 @@ std::string Chip8::get_opcode_string(uint16_t opcode)
 	return ss.str();
 }
 
-void Chip8::cycle(std::vector<std::string>& opcode_history)
+void Chip8::cycle()
+{
+	((*this).*(next_instruction()->func))();
+}
+
+void Chip8::set_tracing(bool enabled)
+{
+	tracing = enabled;
+	trace_head = 0;
+	trace_count = 0;
+}
+
+Chip8::TraceEntry Chip8::trace_at(unsigned int i) const
+{
+	return trace[(trace_head + TRACE_CAPACITY - trace_count + i) % TRACE_CAPACITY];
+}
+
+void Chip8::set_hashing(bool enabled)
+{
+	hashing = enabled;
+	if (enabled) {
+		memory_hash = hash_memory();
+		video_hash = hash_video();
+	}
+}
+
+uint64_t Chip8::state_hash() const
+{
+	if (!hashing)
+		return full_hash();
+	return hash_cpu(memory_hash ^ video_hash);
+}
+
+uint64_t Chip8::full_hash() const
+{
+	return hash_cpu(hash_memory() ^ hash_video());
+}
+
+uint64_t Chip8::hash_memory() const
 {
-	opcode = (memory[pc] << 8) | memory[pc + 1];
+	uint64_t hash = 0;
+	for (unsigned int address = 0; address < MEMORY_SIZE; address++)
+		hash ^= memory_key(address, read(static_cast<uint16_t>(address)));
+	return hash;
+}
 
-	opcode_history.push_back(get_opcode_string(opcode));
+uint64_t Chip8::hash_video() const
+{
+	const uint64_t* rows = video.get().rows;
+	uint64_t hash = 0;
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++)
+		hash ^= video_key(row, rows[row]);
+	return hash;
+}
 
-	if (opcode_history.size() > 50)
-		opcode_history.erase(opcode_history.begin());
+uint64_t Chip8::hash_cpu(uint64_t hash) const
+{
+	uint64_t words[9];
+	memcpy(words, registers, sizeof(registers));
+	words[2] = index | static_cast<uint64_t>(pc) << 16u | static_cast<uint64_t>(sp) << 32u
+		| static_cast<uint64_t>(delay_timer) << 40u | static_cast<uint64_t>(sound_timer) << 48u;
+	words[3] = keys;
+	// Entries above sp are dead, and save_state drops them.
+	uint16_t live[STACK_LEVELS]{};
+	memcpy(live, stack, (sp < STACK_LEVELS ? sp : STACK_LEVELS) * sizeof(stack[0]));
+	memcpy(&words[4], live, sizeof(live));
+	words[8] = rng.get_state();
 
-	pc += 2;
+	// Independent keys rather than a chain, so the mixes overlap.
+	for (unsigned int i = 0; i < 9; i++)
+		hash ^= splitmix64(words[i] + (i + 1u) * 0xC2B2AE3D27D4EB4Full);
+	return hash;
+}
 
-	((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+void Chip8::rehash_rows(const uint64_t* before, uint32_t rows)
+{
+	const uint64_t* after = video.get().rows;
+	for (unsigned int row = 0; rows; row++, rows >>= 1u) {
+		if (rows & 1u)
+			video_hash ^= video_key(row, before[row]) ^ video_key(row, after[row]);
+	}
+}
 
+void Chip8::tick_timers()
+{
 	if (delay_timer > 0)
 		delay_timer--;
 
@@ -166,6 +366,96 @@ void Chip8::cycle(std::vector<std::string>& opcode_history)
 		sound_timer--;
 }
 
+void Chip8::tick_timers(uint64_t ticks)
+{
+	delay_timer = ticks < delay_timer ? static_cast<uint8_t>(delay_timer - ticks) : 0;
+	sound_timer = ticks < sound_timer ? static_cast<uint8_t>(sound_timer - ticks) : 0;
+}
+
+bool Chip8::poll_loop(uint16_t& start) const
+{
+	for (uint16_t offset = 0; offset <= 4; offset += 2) {
+		uint16_t at = pc - offset;
+		uint16_t load = fetch(at);
+		uint16_t test = fetch(at + 2);
+		uint8_t family = test >> 12u;
+
+		// 1NNN can only jump below 0x1000.
+		if (at <= 0xFFFu && (load & 0xF0FFu) == 0xF007u && (family == 0x3 || family == 0x4) && ((test ^ load) & 0x0F00u) == 0
+			&& fetch(at + 4) == (0x1000u | at)) {
+			start = at;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Chip8::polling(uint16_t start) const
+{
+	uint16_t test = fetch(start + 2);
+	bool equal = delay_timer == (test & 0x00FFu);
+
+	// 3XKK leaves the loop once the timer reaches kk, 4XKK once it moves off it.
+	return (test >> 12u) == 0x3 ? !equal : equal;
+}
+
+Chip8::IdleState Chip8::idle_state() const
+{
+	uint16_t op = fetch(pc);
+	if (pc <= 0xFFFu && op == (0x1000u | pc))
+		return IdleState::Halt;
+	if ((op & 0xF0FFu) == 0xF00Au && !keys)
+		return IdleState::KeyWait;
+
+	uint16_t start;
+	if (poll_loop(start) && polling(start))
+		return IdleState::TimerPoll;
+
+	return IdleState::None;
+}
+
+uint64_t Chip8::skip_idle(uint64_t cycles)
+{
+	switch (idle_state()) {
+	case IdleState::KeyWait:
+	case IdleState::Halt:
+		return cycles;
+	case IdleState::TimerPoll: {
+		uint16_t start;
+		poll_loop(start);
+
+		// Entered part way round, Vx may still hold a value read before the last tick, so run up to the
+		// jump for real. None of the loop's instructions write memory, so this is safe under the JIT too.
+		uint64_t executed = 0;
+		while (pc != start && executed < cycles) {
+			cycle();
+			executed++;
+		}
+		if (pc != start || !polling(start))
+			return executed;
+
+		// Every full trip round the loop ends back at start with Vx holding the delay timer.
+		uint64_t skipped = (cycles - executed) / 3 * 3;
+		if (skipped)
+			registers[(fetch(start) & 0x0F00u) >> 8u] = delay_timer;
+		return executed + skipped;
+	}
+	default:
+		return 0;
+	}
+}
+
+void Chip8::expand_video(uint32_t* pixels) const
+{
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		uint64_t line = video.get().rows[y];
+
+		for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+			pixels[y * VIDEO_WIDTH + x] = (line >> (63u - x)) & 1u ? 0xFFFFFFFF : 0;
+	}
+}
+
 void Chip8::print_registers(std::vector<std::string>& register_info)
 {
 	register_info.clear();
@@ -182,34 +472,48 @@ void Chip8::print_registers(std::vector<std::string>& register_info)
 
 void Chip8::OP_00E0()
 {
-	memset(video, 0, sizeof(video));
+	const uint64_t* rows = video.get().rows;
+	uint32_t cleared = 0;
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++)
+		cleared |= (rows[row] != 0 ? 1u : 0u) << row;
+
+	// A blank display stays shared.
+	if (cleared) {
+		uint64_t before[VIDEO_HEIGHT];
+		if (hashing)
+			memcpy(before, rows, sizeof(before));
+		memset(video.write().rows, 0, sizeof(VideoPage::rows));
+		if (hashing)
+			rehash_rows(before, cleared);
+	}
+	mark_dirty(cleared);
 }
 
 void Chip8::OP_00EE()
 {
 	sp--;
-	pc = stack[sp];
+	pc = stack[sp & 0xFu];
 }
 
 void Chip8::OP_1NNN()
 {
-	uint16_t addr = opcode & 0xFFFu;
+	uint16_t addr = instr->nnn;
 	pc = addr;
 }
 
 void Chip8::OP_2NNN()
 {
-	uint16_t addr = opcode & 0x0FFFu;
+	uint16_t addr = instr->nnn;
 
-	stack[sp] = pc;
+	stack[sp & 0xFu] = pc;
 	sp++;
 	pc = addr;
 }
 
 void Chip8::OP_3XKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = instr->x;
+	uint8_t byte = instr->kk;
 
 	if (registers[Vx] == byte)
 		pc += 2;
@@ -217,8 +521,8 @@ void Chip8::OP_3XKK()
 
 void Chip8::OP_4XKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = instr->x;
+	uint8_t byte = instr->kk;
 
 	if (registers[Vx] != byte)
 		pc += 2;
@@ -226,8 +530,8 @@ void Chip8::OP_4XKK()
 
 void Chip8::OP_5XY0()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	if (registers[Vx] == registers[Vy])
 		pc += 2;
@@ -235,56 +539,56 @@ void Chip8::OP_5XY0()
 
 void Chip8::OP_6XKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = instr->x;
+	uint8_t byte = instr->kk;
 
 	registers[Vx] = byte;
 }
 
 void Chip8::OP_7XKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = instr->x;
+	uint8_t byte = instr->kk;
 
 	registers[Vx] += byte;
 }
 
 void Chip8::OP_8XY0()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	registers[Vx] = registers[Vy];
 }
 
 void Chip8::OP_8XY1()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	registers[Vx] |= registers[Vy];
 }
 
 void Chip8::OP_8XY2()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	registers[Vx] &= registers[Vy];
 }
 
 void Chip8::OP_8XY3()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	registers[Vx] ^= registers[Vy];
 }
 
 void Chip8::OP_8XY4()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	uint16_t sum = registers[Vx] + registers[Vy];
 
@@ -298,8 +602,8 @@ void Chip8::OP_8XY4()
 
 void Chip8::OP_8XY5()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	if (registers[Vx] > registers[Vy])
 		registers[0xF] = 1;
@@ -311,7 +615,7 @@ void Chip8::OP_8XY5()
 
 void Chip8::OP_8XY6()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	registers[0xF] = (registers[Vx] & 0x1u);
 
@@ -320,8 +624,8 @@ void Chip8::OP_8XY6()
 
 void Chip8::OP_8XY7()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	if (registers[Vy] > registers[Vx])
 		registers[0xF] = 1;
@@ -333,7 +637,7 @@ void Chip8::OP_8XY7()
 
 void Chip8::OP_8XYE()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
 
@@ -342,8 +646,8 @@ void Chip8::OP_8XYE()
 
 void Chip8::OP_9XY0()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
 
 	if (registers[Vx] != registers[Vy])
 		pc += 2;
@@ -351,143 +655,126 @@ void Chip8::OP_9XY0()
 
 void Chip8::OP_ANNN()
 {
-	uint16_t addr = opcode & 0x0FFFu;
+	uint16_t addr = instr->nnn;
 
 	index = addr;
 }
 
 void Chip8::OP_BNNN()
 {
-	uint16_t addr = opcode & 0x0FFFu;
+	uint16_t addr = instr->nnn;
 
 	pc = registers[0] + addr;
 }
 
 void Chip8::OP_CXKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = instr->x;
+	uint8_t byte = instr->kk;
 
-	registers[Vx] = static_cast<uint8_t>(rand_byte(rand_gen)) & byte;
+	registers[Vx] = rng.next_byte() & byte;
 }
 
 void Chip8::OP_DXYN()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-	uint8_t height = opcode & 0x000Fu;
+	uint8_t Vx = instr->x;
+	uint8_t Vy = instr->y;
+	uint8_t height = instr->n;
 
 	uint8_t x_pos = registers[Vx] % VIDEO_WIDTH;
 	uint8_t y_pos = registers[Vy] % VIDEO_HEIGHT;
 
-	registers[0xF] = 0;
+	// The blitter reads rows from one pointer, so a sprite running across a page boundary is gathered first.
+	uint16_t address = index & 0xFFFu;
+	const uint8_t* sprite = &memory[address >> 8u].get().bytes[address & 0xFFu];
+	uint8_t gathered[16];
+	if ((address & 0xFFu) + height > MEMORY_PAGE_SIZE) {
+		for (uint8_t row = 0; row < height; row++)
+			gathered[row] = read((address + row) & 0xFFFu);
+		sprite = gathered;
+	}
 
-	for (unsigned int row = 0; row < height; row++) {
-		uint8_t sprite_byte = memory[index + row];
+	// A sprite that draws nothing leaves the display shared.
+	if (!sprite_draws(sprite, 0, x_pos, y_pos, height, sprite_edge)) {
+		registers[0xF] = 0;
+		return;
+	}
 
-		for (unsigned int col = 0; col < 8; col++) {
-			uint8_t sprite_pixel = sprite_byte & (0x80u >> col);
-			uint32_t* screen_pixel = &video[(y_pos + row) * VIDEO_WIDTH + (x_pos + col)];
+	// Only the rows under the sprite can change.
+	uint64_t before[VIDEO_HEIGHT];
+	for (uint8_t row = 0; hashing && row < height; row++)
+		before[(y_pos + row) & 31u] = video.get().rows[(y_pos + row) & 31u];
 
-			if (sprite_pixel) {
-				if (*screen_pixel == 0xFFFFFFFF) {
-					registers[0xF] = 1;
-				}
-				*screen_pixel ^= 0xFFFFFFFF;
-			}
-		}
-	}
+	uint32_t changed = 0;
+	registers[0xF] = blit_sprite(video.write().rows, sprite, 0, x_pos, y_pos, height, sprite_edge, changed);
+	if (hashing)
+		rehash_rows(before, changed);
+	mark_dirty(changed);
 }
 
 void Chip8::OP_EX9E()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 	uint8_t key = registers[Vx];
 
-	if (keypad[key])
+	if (keys & (1u << (key & 0xFu)))
 		pc += 2;
 }
 
 void Chip8::OP_EXA1()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 	uint8_t key = registers[Vx];
 
-	if (!keypad[key])
+	if (!(keys & (1u << (key & 0xFu))))
 		pc += 2;
 }
 
 void Chip8::OP_FX07()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	registers[Vx] = delay_timer;
 }
 
 void Chip8::OP_FX0A()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-
-	if (keypad[0])
-		registers[Vx] = 0;
-	else if (keypad[1])
-		registers[Vx] = 1;
-	else if (keypad[2])
-		registers[Vx] = 2;
-	else if (keypad[3])
-		registers[Vx] = 3;
-	else if (keypad[4])
-		registers[Vx] = 4;
-	else if (keypad[5])
-		registers[Vx] = 5;
-	else if (keypad[6])
-		registers[Vx] = 6;
-	else if (keypad[7])
-		registers[Vx] = 7;
-	else if (keypad[8])
-		registers[Vx] = 8;
-	else if (keypad[9])
-		registers[Vx] = 9;
-	else if (keypad[10])
-		registers[Vx] = 10;
-	else if (keypad[11])
-		registers[Vx] = 11;
-	else if (keypad[12])
-		registers[Vx] = 12;
-	else if (keypad[13])
-		registers[Vx] = 13;
-	else if (keypad[14])
-		registers[Vx] = 14;
-	else if (keypad[15])
-		registers[Vx] = 15;
-	else
-		pc -= 2;
+	uint8_t Vx = instr->x;
+
+	for (uint8_t key = 0; key < KEY_COUNT; key++) {
+		if (keys & (1u << key)) {
+			registers[Vx] = key;
+			return;
+		}
+	}
+
+	pc -= 2;
 }
 
 void Chip8::OP_FX15()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	delay_timer = registers[Vx];
 }
 
 void Chip8::OP_FX18()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	sound_timer = registers[Vx];
 }
 
 void Chip8::OP_FX1E()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	index += registers[Vx];
 }
 
 void Chip8::OP_FX29()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 	uint8_t digit = registers[Vx];
 
 	index = FONTSET_START_ADDRESS + (5 * digit);
@@ -495,31 +782,24 @@ void Chip8::OP_FX29()
 
 void Chip8::OP_FX33()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 	uint8_t value = registers[Vx];
+	uint8_t digits[3] = { static_cast<uint8_t>(value / 100), static_cast<uint8_t>(value / 10 % 10), static_cast<uint8_t>(value % 10) };
 
-	memory[index + 2] = value % 10;
-	value /= 10;
-
-	memory[index + 1] = value % 10;
-	value /= 10;
-
-	memory[index] = value % 10;
-
+	write(index, digits, 3);
 }
 
 void Chip8::OP_FX55()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
-	for (uint8_t i = 0; i <= Vx; i++)
-		memory[index + i] = registers[i];
+	write(index, registers, Vx + 1u);
 }
 
 void Chip8::OP_FX65()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = instr->x;
 
 	for (uint8_t i = 0; i <= Vx; i++)
-		registers[i] = memory[index + i];
+		registers[i] = read(index + i);
 }
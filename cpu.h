@@ -1,37 +1,215 @@
 #ifndef CPU
 #define CPU
+#include <atomic>
 #include <cstdint>
 #include <string>
+#include <utility>
 #include <chrono>
-#include <random>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include "rng.h"
+#include "blit.h"
+#include "profile.h"
+#include <vector>
 
 const unsigned int KEY_COUNT = 16;
 const unsigned int MEMORY_SIZE = 4096;
+const unsigned int MEMORY_PAGE_SIZE = 256;
+const unsigned int MEMORY_PAGES = MEMORY_SIZE / MEMORY_PAGE_SIZE;
 const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
 const unsigned int VIDEO_WIDTH = 64;
 const unsigned int VIDEO_HEIGHT = 32;
+const unsigned int TRACE_CAPACITY = 64;
+const unsigned int FONTSET_SIZE = 80;
+const unsigned int START_ADDRESS = 0x200;
+const unsigned int FONTSET_START_ADDRESS = 0x50;
+// Registers, index, pc, sp, timers, keys, stack, RNG state, video and memory; see Chip8::snapshot.
+const unsigned int SNAPSHOT_SIZE = REGISTER_COUNT + 2 + 2 + 1 + 1 + 1 + 2 + 2 * STACK_LEVELS + 8 + VIDEO_HEIGHT * 8 + MEMORY_SIZE;
 
 class Chip8 {
+	friend class Chip8Jit;
+	friend class Chip8Batch;
 public:
 	Chip8();
-	void LoadROM(char const* filename);
+	explicit Chip8(uint64_t seed);
+	bool LoadROM(char const* filename);
+	// Loads a ROM image already in memory, e.g. one generated on the fly.
+	bool LoadROM(const uint8_t* data, size_t size);
+
+	// A machine in the same state that shares this one's memory and display until either writes to them,
+	// then copies only the page written: about 6.4 KB for memory, see MemoryPage. A fork copies the registers, timers, stack and RNG and takes
+	// a reference to each page, so search code can branch a running machine cheaply; copying a Chip8 does the
+	// same. Forks are independent and may run on different threads.
+	Chip8 fork() const {
+		return *this;
+	}
+
 	std::string get_opcode_string(uint16_t opcode);
-	void cycle(std::vector<std::string>& opcode_history);
+	void cycle();
+	// cycle() that also reports the instruction to `profile`, a policy such as OpcodeProfile from profile.h.
+	template <class Profile>
+	void cycle(Profile& profile);
+	void tick_timers();
+	// Same as calling tick_timers() `ticks` times.
+	void tick_timers(uint64_t ticks);
+
+	struct TraceEntry {
+		uint16_t pc;
+		uint16_t opcode;
+	};
+
+	// Records the last TRACE_CAPACITY executed instructions while enabled; off by default.
+	void set_tracing(bool enabled);
+	unsigned int trace_size() const {
+		return trace_count;
+	}
+	// 0 is the oldest recorded instruction.
+	TraceEntry trace_at(unsigned int i) const;
 	uint8_t get_soundtimer() {
 		return sound_timer;
 	}
 
 	void print_registers(std::vector<std::string>& register_info);
 
-	uint32_t video[VIDEO_WIDTH * VIDEO_HEIGHT]{};
-	uint8_t keypad[KEY_COUNT]{};
+	// One row per word, bit 63 is the leftmost pixel.
+	const uint64_t* get_video() const {
+		return video.get().rows;
+	}
+
+	// One byte of memory, such as a ROM's score or level counter.
+	uint8_t get_memory(uint16_t address) const {
+		return read(address & 0xFFFu);
+	}
+
+	// Writes VIDEO_WIDTH * VIDEO_HEIGHT pixels, 0xFFFFFFFF for set and 0 for clear.
+	void expand_video(uint32_t* pixels) const;
+
+	// Sprites past the right or bottom edge are clipped by default; some ROMs expect them to wrap.
+	void set_sprite_edge(SpriteEdge edge) {
+		sprite_edge = edge;
+	}
+
+	// Bumped by every DXYN or 00E0 that changes a pixel, and by load_state.
+	uint64_t get_video_generation() const {
+		return video_generation;
+	}
+	// Bit n set if row n changed since the last call; the set is cleared on return.
+	uint32_t take_dirty_rows() {
+		uint32_t rows = dirty_rows;
+		dirty_rows = 0;
+		return rows;
+	}
+
+	// Reseeds the CXKK generator; two machines with the same ROM, seed and input run identically.
+	void seed(uint64_t value) {
+		rng.seed(value);
+	}
+
+	// Versioned, compact snapshot of the whole machine: registers, timers, stack, keys, RNG, video and memory.
+	// save_state returns the number of bytes written, or 0 if capacity is too small; with a null buffer it
+	// returns the size required. load_state leaves the machine untouched if the blob is rejected.
+	size_t save_state(uint8_t* buffer, size_t capacity) const;
+	bool load_state(const uint8_t* buffer, size_t size);
+	bool save_state(char const* filename) const;
+	bool load_state(char const* filename);
+
+	// The same state as a fixed-size, uncompressed image in host byte order, for keeping many states in
+	// memory and diffing consecutive ones: SNAPSHOT_SIZE bytes. restore_snapshot takes only what snapshot
+	// wrote; it invalidates just the decoded instructions whose bytes changed and marks just the rows that differ.
+	void snapshot(uint8_t* out) const;
+	void restore_snapshot(const uint8_t* in);
+
+	// Zobrist-style 64-bit hash of everything save_state() keeps: machines that save the same state hash equal.
+	// Memory and the display contribute one key per byte or row, drawn from its position and value, so while
+	// hashing is on every write to them (FX33, FX55, DXYN, 00E0, loading) swaps the old key out for the new
+	// one. state_hash() then only folds in the registers, stack, timers, keys and RNG, O(1) after any
+	// instruction. Off by default, when state_hash() is computed from scratch.
+	void set_hashing(bool enabled);
+	uint64_t state_hash() const;
+	// The same hash recomputed over the whole machine, for checking the running one.
+	uint64_t full_hash() const;
+
+	// What the machine is spinning on at pc, if anything. KeyWait is FX0A with no key held and Halt a 1NNN
+	// jump to itself; neither changes any state. TimerPoll is an FX07 / 3XKK or 4XKK / 1NNN loop waiting on
+	// the delay timer that can't exit before the next tick_timers().
+	enum class IdleState {
+		None,
+		KeyWait,
+		Halt,
+		TimerPoll
+	};
+	IdleState idle_state() const;
+
+	// Advances up to `cycles` instructions of an idle loop without dispatching them, leaving the machine as
+	// running them would have; the caller runs the rest. Returns the number of cycles consumed, 0 when not
+	// idle. Skipped instructions are not traced.
+	uint64_t skip_idle(uint64_t cycles);
+
+	// Bit n set means key n is held.
+	void set_keys(uint16_t mask) {
+		keys = mask;
+	}
+	uint16_t get_keys() const {
+		return keys;
+	}
 private:
+	// Reference to a page shared between forks. get() reads it in place; write() first gives this machine
+	// its own copy if anything else still holds the page.
+	template <class Page>
+	class Shared {
+	public:
+		Shared() : page(new Page()) {}
+		Shared(const Shared& other) : page(other.page) {
+			page->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		Shared(Shared&& other) : page(other.page) {
+			other.page = nullptr;
+		}
+		Shared& operator=(Shared other) {
+			std::swap(page, other.page);
+			return *this;
+		}
+		~Shared() {
+			release();
+		}
+
+		const Page& get() const {
+			return *page;
+		}
+		bool unique() const {
+			return page->refs.load(std::memory_order_acquire) == 1;
+		}
+		Page& write() {
+			if (!unique()) {
+				Page* copy = new Page(*page);
+				release();
+				page = copy;
+			}
+			return *page;
+		}
+
+	private:
+		void release() {
+			if (page && page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete page;
+		}
+
+		Page* page;
+	};
+
+	struct VideoPage {
+		std::atomic<uint32_t> refs{ 1 };
+		uint64_t rows[VIDEO_HEIGHT]{};
+
+		VideoPage() = default;
+		VideoPage(const VideoPage& other);
+	};
+
+	uint16_t keys{};
+	Shared<VideoPage> video;
 	uint8_t registers[REGISTER_COUNT]{};
-	uint8_t memory[MEMORY_SIZE]{};
 	uint16_t index{};
 	uint16_t pc{};
 	uint16_t stack[STACK_LEVELS]{};
@@ -41,10 +219,32 @@ private:
 
 	uint16_t opcode{};
 
-	void Table0();
-	void Table8();
-	void TableE();
-	void TableF();
+	SpriteEdge sprite_edge{ SpriteEdge::Clip };
+
+	uint32_t dirty_rows{};
+	uint64_t video_generation{};
+
+	void mark_dirty(uint32_t rows) {
+		dirty_rows |= rows;
+		video_generation += rows != 0;
+	}
+
+	TraceEntry trace[TRACE_CAPACITY]{};
+	unsigned int trace_head{};
+	unsigned int trace_count{};
+	bool tracing{};
+
+	// Running XORs of the memory and display keys; valid while hashing is set.
+	bool hashing{};
+	uint64_t memory_hash{};
+	uint64_t video_hash{};
+	uint64_t hash_memory() const;
+	uint64_t hash_video() const;
+	// Folds the registers, stack, timers, keys and RNG into `hash`.
+	uint64_t hash_cpu(uint64_t hash) const;
+	// Updates video_hash for each row in `rows` that held before[row] and now holds something else.
+	void rehash_rows(const uint64_t* before, uint32_t rows);
+
 	void OP_NULL();
 
 	void OP_1NNN();
@@ -86,16 +286,127 @@ private:
 	void OP_FX55();
 	void OP_FX65();
 
-	std::default_random_engine rand_gen;
-	std::uniform_int_distribution<unsigned int> rand_byte;
+	Chip8Rng rng;
 
+	// The same for every machine, so they are shared rather than carried by each one.
 	typedef void (Chip8::* Chip8Func)();
-	Chip8Func table[0xF + 1];
-	Chip8Func table0[0xE + 1];
-	Chip8Func table8[0xE + 1];
-	Chip8Func tableE[0xE + 1];
-	Chip8Func tableF[0x65 + 1];
+	static Chip8Func table[0xF + 1];
+	static Chip8Func table0[0xE + 1];
+	static Chip8Func table8[0xE + 1];
+	static Chip8Func tableE[0xE + 1];
+	static Chip8Func tableF[0x65 + 1];
+	static void fill_tables();
+
+	struct Instruction {
+		Chip8Func func;
+		uint16_t opcode;
+		uint16_t nnn;
+		uint8_t x;
+		uint8_t y;
+		uint8_t n;
+		uint8_t kk;
+	};
+
+	// A page of memory together with the decoded instruction at each of its addresses. ROMs do jump to odd
+	// addresses, so every address gets an entry rather than just the even ones, which makes a page about
+	// 6.4 KB rather than 256 bytes, and that is what copying one costs. Loading memory decodes the entries
+	// it changed straight away, so forks can run the code without writing to shared pages; an entry cleared
+	// by an instruction's write is decoded again on first execution.
+	struct MemoryPage {
+		std::atomic<uint32_t> refs{ 1 };
+		uint8_t bytes[MEMORY_PAGE_SIZE]{};
+		Instruction decoded[MEMORY_PAGE_SIZE];
+
+		MemoryPage();
+		MemoryPage(const MemoryPage& other);
+	};
+
+	Shared<MemoryPage> memory[MEMORY_PAGES];
+	const Instruction* instr{};
+
+	// The decoded entries of the page pc was last in, saving the dispatch a load through the page table.
+	// Reset whenever a page is copied.
+	const Instruction* code{};
+	unsigned int code_page{ MEMORY_PAGES };
+	MemoryPage& writable(unsigned int page) {
+		if (!memory[page].unique())
+			code_page = MEMORY_PAGES;
+		return memory[page].write();
+	}
+
+	static void decode(uint16_t op, Instruction& entry);
+	// Decodes into the entry for `address`, copying its page first if it is shared.
+	const Instruction* decode_at(uint16_t address);
+	// Decodes and traces the instruction at pc and steps past it, leaving only its handler to run.
+	const Instruction* next_instruction();
+	// Clears the decoded entry at `address`, to be decoded again when next executed.
+	void invalidate(uint16_t address);
+
+	uint8_t read(uint16_t address) const {
+		return memory[(address >> 8u) & 0xFu].get().bytes[address & 0xFFu];
+	}
+	// Stores bytes from `address` on, wrapping at the end of memory. A shared page is copied first, unless
+	// its bytes are the same already.
+	void write(uint16_t address, const uint8_t* data, size_t size);
+	// Stores a block and decodes the instructions over it that changed. Like write(), leaves pages whose
+	// bytes are the same already shared.
+	void store(uint16_t address, const uint8_t* data, size_t size);
+	// Copies all MEMORY_SIZE bytes of memory to `out`.
+	void copy_memory(uint8_t* out) const;
+
+	uint16_t fetch(uint16_t address) const {
+		return (read(address & 0xFFFu) << 8) | read((address + 1u) & 0xFFFu);
+	}
+	// Finds the delay polling loop pc is in, at any of its three instructions.
+	bool poll_loop(uint16_t& start) const;
+	// Whether the poll loop at `start` keeps spinning on the current delay timer value.
+	bool polling(uint16_t start) const;
 
 };
 
+inline const Chip8::Instruction* Chip8::next_instruction()
+{
+	unsigned int page = (pc >> 8u) & 0xFu;
+	if (page != code_page) {
+		code = memory[page].get().decoded;
+		code_page = page;
+	}
+	const Instruction* entry = &code[pc & 0xFFu];
+
+	if (!entry->func)
+		entry = decode_at(pc);
+
+	instr = entry;
+	opcode = entry->opcode;
+
+	if (tracing) {
+		trace[trace_head] = { pc, opcode };
+		trace_head = (trace_head + 1) % TRACE_CAPACITY;
+		if (trace_count < TRACE_CAPACITY)
+			trace_count++;
+	}
+
+	pc += 2;
+	return entry;
+}
+
+template <class Profile>
+void Chip8::cycle(Profile& profile)
+{
+	uint16_t address = pc & 0xFFFu;
+	const Instruction* entry = next_instruction();
+
+	// The handler may overwrite its own entry, so the opcode is taken first.
+	uint16_t op = entry->opcode;
+	if (profile.sampling()) {
+		auto start = std::chrono::steady_clock::now();
+		((*this).*(entry->func))();
+		profile.sample(address, op, std::chrono::steady_clock::now() - start);
+	}
+	else {
+		((*this).*(entry->func))();
+		profile.count(address, op);
+	}
+}
+
 #endif // !CPU
\ No newline at end of file
@@ -0,0 +1,389 @@
+#include "explore.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+namespace {
+
+// Lit pixels in each byte of a row, one count per byte.
+uint64_t byte_counts(uint64_t x)
+{
+	x = x - ((x >> 1u) & 0x5555555555555555ull);
+	x = (x & 0x3333333333333333ull) + ((x >> 2u) & 0x3333333333333333ull);
+	return (x + (x >> 4u)) & 0x0F0F0F0F0F0F0F0Full;
+}
+
+// Cell keys for one machine. Each band of block_height rows packs its blocks' levels into a word, and the
+// display's part of the key is the XOR of one key per band word, so only the bands holding rows the display
+// changed since the last key are worked out again.
+class CellView {
+public:
+	explicit CellView(const ExploreConfig& config) : config(config) {}
+
+	// With `all`, ignores which rows changed; needed first on every machine.
+	uint64_t key(Chip8& chip8, bool all) {
+		uint32_t rows = chip8.take_dirty_rows();
+		if (all) {
+			rows = 0xFFFFFFFFu;
+			for (unsigned int i = 0; i < VIDEO_HEIGHT; i++)
+				bands[i] = 0;
+			video_key = 0;
+			for (unsigned int top = 0; top < VIDEO_HEIGHT; top += config.block_height)
+				video_key ^= band_key(top, 0);
+		}
+
+		const uint64_t* video = chip8.get_video();
+		for (unsigned int top = 0; top < VIDEO_HEIGHT && rows >> top; top += config.block_height) {
+			uint32_t band_rows = static_cast<uint32_t>(((1ull << config.block_height) - 1u) << top);
+			if (!(rows & band_rows))
+				continue;
+			uint64_t& word = bands[top / config.block_height];
+			uint64_t updated = band(video, top);
+			if (updated != word) {
+				video_key ^= band_key(top, word) ^ band_key(top, updated);
+				word = updated;
+			}
+		}
+
+		uint64_t hash = video_key;
+		for (uint16_t address : config.watch)
+			hash = splitmix64(hash ^ (static_cast<uint64_t>(address) << 8u | chip8.get_memory(address))) + 0x9E3779B97F4A7C15ull;
+		return hash;
+	}
+
+private:
+	const ExploreConfig& config;
+	uint64_t bands[VIDEO_HEIGHT]{};
+	uint64_t video_key{};
+
+	static uint64_t band_key(unsigned int top, uint64_t word) {
+		return splitmix64(word ^ (top + 1u) * 0x9E3779B97F4A7C15ull);
+	}
+
+	uint64_t band(const uint64_t* video, unsigned int top) const {
+		unsigned int bottom = std::min(top + config.block_height, VIDEO_HEIGHT);
+
+		// Byte counts summed down the band in 16-bit lanes, even bytes in one word and odd in the other.
+		uint64_t even = 0;
+		uint64_t odd = 0;
+		for (unsigned int y = top; y < bottom; y++) {
+			uint64_t counts = byte_counts(video[y]);
+			even += counts & 0x00FF00FF00FF00FFull;
+			odd += (counts >> 8u) & 0x00FF00FF00FF00FFull;
+		}
+
+		// 1 + (lit - 1) * (levels - 1) / area, with the division done once per band as a 32.32 reciprocal.
+		unsigned int area = config.block_width * (bottom - top);
+		uint64_t scale = (static_cast<uint64_t>(config.levels - 1u) << 32u) / area;
+		unsigned int bytes = config.block_width / 8u;
+		uint64_t word = 0;
+		for (unsigned int block = 0; block < VIDEO_WIDTH / config.block_width; block++) {
+			unsigned int lit = 0;
+			for (unsigned int byte = block * bytes; byte < (block + 1u) * bytes; byte++)
+				lit += static_cast<unsigned int>(((byte & 1u ? odd : even) >> (16u * (byte / 2u))) & 0xFFFFu);
+			unsigned int level = lit ? 1u + static_cast<unsigned int>(((lit - 1u) * scale) >> 32u) : 0u;
+			word |= static_cast<uint64_t>(level) << (8u * block);
+		}
+		return word;
+	}
+};
+
+// How many frames a step may run in all, in multiples of its active ones.
+const unsigned int IDLE_ALLOWANCE = 8;
+
+// A new or shorter cell one step passed through, `frame` frames into the step.
+struct Found {
+	uint64_t key;
+	unsigned int frame;
+};
+
+// Uniform in [0, bound); the generator only hands out bytes.
+uint64_t draw(Xorshift64& random, uint64_t bound)
+{
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < 7; i++)
+		value = (value << 8u) | random.next_byte();
+	return value % bound;
+}
+
+// Cells picked and reached least weigh most, as in Go-Explore's count-based selection.
+uint64_t weight(const ExploreCell& cell)
+{
+	const double scale = 1u << 20u;
+	return static_cast<uint64_t>(scale / std::sqrt(cell.chosen + 1.0) + scale / std::sqrt(cell.seen + 1.0));
+}
+
+}
+
+// A worker's buffers, kept from one step to the next.
+struct Explorer::Scratch {
+	std::vector<uint16_t> keys;
+	std::vector<Found> found;
+	std::vector<Found> wanted;
+	std::vector<ExploreCell> captured;
+};
+
+Explorer::Explorer(const ExploreConfig& config) : config(config), thread_count(config.threads)
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	choices.push_back(0);
+	for (unsigned int key = 0; key < KEY_COUNT; key++) {
+		if (config.keys & (1u << key))
+			choices.push_back(static_cast<uint16_t>(1u << key));
+	}
+}
+
+bool Explorer::load(char const* rom)
+{
+	unsigned int width = config.block_width;
+	if ((width != 8 && width != 16 && width != 32 && width != 64) || config.block_height == 0
+		|| config.block_height > VIDEO_HEIGHT || config.levels < 2 || config.levels > 255 || config.rate == 0
+		|| config.frames == 0 || config.hold == 0)
+		return false;
+
+	std::ifstream file(rom, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	Chip8 boot(config.seed);
+	if (!boot.LoadROM(data.data(), data.size()))
+		return false;
+	rom_hash = Movie::hash_rom(data.data(), data.size());
+
+	cells.clear();
+	index.clear();
+	weights.clear();
+	tree.assign(1, 0);
+	total_weight = 0;
+
+	CellView view(config);
+	uint64_t key = view.key(boot, true);
+	add({ key, boot, 0, nullptr, 0, 0 });
+	return true;
+}
+
+void Explorer::add(ExploreCell cell)
+{
+	index[cell.key] = static_cast<uint32_t>(cells.size());
+	cells.push_back(std::move(cell));
+	weights.push_back(weight(cells.back()));
+	total_weight += weights.back();
+
+	// Appending node n to a Fenwick tree: it covers the n & -n weights ending at its own.
+	size_t n = cells.size();
+	uint64_t sum = weights.back();
+	for (size_t child = n - 1u; child > n - (n & (~n + 1u)); child -= child & (~child + 1u))
+		sum += tree[child];
+	tree.push_back(sum);
+}
+
+void Explorer::reweight(size_t i)
+{
+	uint64_t updated = weight(cells[i]);
+	// Unsigned wraparound makes a lighter weight a negative delta.
+	uint64_t delta = updated - weights[i];
+	weights[i] = updated;
+	total_weight += delta;
+	for (size_t node = i + 1u; node < tree.size(); node += node & (~node + 1u))
+		tree[node] += delta;
+}
+
+size_t Explorer::pick(uint64_t target) const
+{
+	size_t n = tree.size() - 1u;
+	size_t bit = 1;
+	while (bit * 2u <= n)
+		bit *= 2u;
+
+	size_t position = 0;
+	for (; bit; bit /= 2u) {
+		if (position + bit <= n && tree[position + bit] <= target) {
+			position += bit;
+			target -= tree[position];
+		}
+	}
+	return position;
+}
+
+uint16_t Explorer::next_keys(Xorshift64& random, uint16_t held) const
+{
+	if (random.next_byte() % config.hold)
+		return held;
+	return choices[random.next_byte() % choices.size()];
+}
+
+bool Explorer::run_frame(Chip8& chip8, uint16_t keys) const
+{
+	chip8.set_keys(keys);
+	for (uint64_t i = chip8.skip_idle(config.rate); i < config.rate; i++)
+		chip8.cycle();
+	chip8.tick_timers();
+	return chip8.idle_state() != Chip8::IdleState::None;
+}
+
+void Explorer::step(Xorshift64& random, Scratch& scratch, ExploreStats& stats)
+{
+	std::vector<uint16_t>& keys = scratch.keys;
+	std::vector<Found>& found = scratch.found;
+	std::vector<Found>& wanted = scratch.wanted;
+	std::vector<ExploreCell>& captured = scratch.captured;
+	keys.clear();
+	found.clear();
+	wanted.clear();
+	captured.clear();
+
+	std::unique_lock<std::mutex> guard(lock);
+	size_t from = pick(draw(random, total_weight));
+	cells[from].chosen++;
+	reweight(from);
+	Chip8 start = cells[from].state.fork();
+	uint64_t start_frames = cells[from].frames;
+	std::shared_ptr<const ExploreRoute> route = cells[from].route;
+	guard.unlock();
+
+	// Play, keeping only the key masks and where the cell changed.
+	Chip8 chip8 = start.fork();
+	CellView view(config);
+	uint64_t last = view.key(chip8, true);
+	uint16_t held = 0;
+	unsigned int active = 0;
+	for (unsigned int frame = 0; active < config.frames && frame < config.frames * IDLE_ALLOWANCE; frame++) {
+		held = next_keys(random, held);
+		keys.push_back(held);
+		active += !run_frame(chip8, held);
+
+		uint64_t key = view.key(chip8, false);
+		if (key != last)
+			found.push_back({ key, frame });
+		last = key;
+	}
+	stats.steps++;
+	stats.frames += keys.size();
+
+	// Only the first visit to each cell can be its shortest route.
+	std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+		return a.key != b.key ? a.key < b.key : a.frame < b.frame;
+	});
+	found.erase(std::unique(found.begin(), found.end(), [](const Found& a, const Found& b) {
+		return a.key == b.key;
+	}), found.end());
+
+	guard.lock();
+	for (const Found& f : found) {
+		auto it = index.find(f.key);
+		if (it == index.end()) {
+			wanted.push_back(f);
+			continue;
+		}
+		ExploreCell& cell = cells[it->second];
+		cell.seen++;
+		reweight(it->second);
+		if (start_frames + f.frame + 1u < cell.frames)
+			wanted.push_back(f);
+	}
+	guard.unlock();
+	if (wanted.empty())
+		return;
+
+	// Play the same keys again from the start, forking at each frame wanted. The routes of one step's
+	// cells chain on each other, sharing the keys they have in common.
+	std::sort(wanted.begin(), wanted.end(), [](const Found& a, const Found& b) {
+		return a.frame < b.frame;
+	});
+	unsigned int frame = 0;
+	for (const Found& f : wanted) {
+		std::shared_ptr<ExploreRoute> segment = std::make_shared<ExploreRoute>();
+		segment->parent = route;
+		for (; frame <= f.frame; frame++) {
+			run_frame(start, keys[frame]);
+			segment->keys.push_back(keys[frame]);
+		}
+		route = segment;
+		captured.push_back({ f.key, start.fork(), start_frames + f.frame + 1u, route, 0, 1 });
+	}
+	stats.frames += frame;
+
+	// Another worker may have found the same cells since.
+	guard.lock();
+	for (ExploreCell& cell : captured) {
+		auto it = index.find(cell.key);
+		if (it == index.end()) {
+			add(std::move(cell));
+			stats.new_cells++;
+		}
+		else if (cell.frames < cells[it->second].frames) {
+			ExploreCell& existing = cells[it->second];
+			existing.state = std::move(cell.state);
+			existing.frames = cell.frames;
+			existing.route = std::move(cell.route);
+		}
+	}
+}
+
+ExploreStats Explorer::run(uint64_t steps, double seconds)
+{
+	std::vector<ExploreStats> stats(thread_count);
+	std::atomic<uint64_t> started{ 0 };
+	auto start = std::chrono::steady_clock::now();
+
+	auto work = [&](unsigned int worker) {
+		// Offset from the machine's seed so the input and CXKK streams differ.
+		Xorshift64 random(config.seed + worker + 1u);
+		Scratch scratch;
+		while (started.fetch_add(1, std::memory_order_relaxed) < steps) {
+			if (seconds > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= seconds)
+				return;
+			step(random, scratch, stats[worker]);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int w = 1; w < thread_count; w++)
+		threads.emplace_back(work, w);
+	work(0);
+	for (auto& thread : threads)
+		thread.join();
+
+	ExploreStats total;
+	for (const ExploreStats& s : stats) {
+		total.steps += s.steps;
+		total.frames += s.frames;
+		total.new_cells += s.new_cells;
+	}
+	total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return total;
+}
+
+std::vector<uint16_t> Explorer::route(size_t i) const
+{
+	std::vector<const ExploreRoute*> segments;
+	for (const ExploreRoute* segment = cells[i].route.get(); segment; segment = segment->parent.get())
+		segments.push_back(segment);
+
+	std::vector<uint16_t> keys;
+	keys.reserve(static_cast<size_t>(cells[i].frames));
+	for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+		keys.insert(keys.end(), (*it)->keys.begin(), (*it)->keys.end());
+	return keys;
+}
+
+Movie Explorer::movie(size_t i) const
+{
+	Movie movie;
+	movie.rom_hash = rom_hash;
+	movie.seed = config.seed;
+	movie.cycles_per_frame = config.rate;
+	movie.length = cells[i].frames * config.rate;
+
+	std::vector<uint16_t> keys = route(i);
+	for (size_t frame = 0; frame < keys.size(); frame++)
+		movie.record(frame * config.rate, keys[frame]);
+	return movie;
+}
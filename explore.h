@@ -0,0 +1,125 @@
+#ifndef EXPLORE
+#define EXPLORE
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "cpu.h"
+#include "movie.h"
+
+// How Explorer plays and what it counts as a new place. A cell is a coarse view of the machine: the display
+// cut into blocks of block_width x block_height pixels, each reduced to how many of its pixels are lit in
+// `levels` steps (any lit pixel reaching the first), plus the bytes at `watch`, such as a level counter.
+// States that look the same at that resolution share a cell.
+struct ExploreConfig {
+	// Cycles per frame; the timers tick once a frame.
+	unsigned int rate = 10;
+	// Frames of random input per step. Frames that end in an idle loop (see Chip8::idle_state) don't count,
+	// up to seven times as many again, so a ROM's pauses don't use up whole steps.
+	unsigned int frames = 60;
+	// Mean number of frames a random key mask is held.
+	unsigned int hold = 4;
+	// Keys the random input presses, one at a time.
+	uint16_t keys = 0xFFFF;
+	// 8, 16, 32 or 64.
+	unsigned int block_width = 8;
+	// 1 to VIDEO_HEIGHT.
+	unsigned int block_height = 4;
+	// 2 to 255.
+	unsigned int levels = 4;
+	std::vector<uint16_t> watch;
+	// Seeds both the machine's CXKK generator and the random input.
+	uint64_t seed = 0;
+	// 0 uses every hardware thread.
+	unsigned int threads = 0;
+};
+
+// The key masks of one step, one per frame, continuing the route to the cell the step started from. Routes
+// share their prefixes and never change, so a cell keeps its route when the cell it came from is replaced.
+struct ExploreRoute {
+	std::shared_ptr<const ExploreRoute> parent;
+	std::vector<uint16_t> keys;
+};
+
+struct ExploreCell {
+	uint64_t key;
+	// The state reached by the shortest route found so far.
+	Chip8 state;
+	uint64_t frames;
+	std::shared_ptr<const ExploreRoute> route;
+	// Times picked to explore from, and times reached by any route.
+	uint32_t chosen;
+	uint32_t seen;
+};
+
+struct ExploreStats {
+	uint64_t steps = 0;
+	// Frames emulated, including those re-run to capture a new cell's state.
+	uint64_t frames = 0;
+	uint64_t new_cells = 0;
+	double seconds = 0;
+};
+
+// Go-Explore over forked machines. Each step picks a cell, favouring those picked and reached least,
+// forks its state and plays random input for a few frames, then adds every cell the step passed through
+// that the archive lacks or reached by a longer route. Steps run on a pool of threads that share the
+// archive under one lock, taken twice a step. A step plays from a fork of the cell's state and keeps
+// only its key masks; the few frames that found something new are re-run from another fork to capture
+// their states, so most steps copy no memory at all.
+class Explorer {
+public:
+	explicit Explorer(const ExploreConfig& config);
+
+	// Boots the ROM as the first cell. False if the ROM can't be loaded or the config is out of range.
+	bool load(char const* rom);
+
+	// Runs `steps` more steps, or stops after `seconds` if that is nonzero and comes first.
+	ExploreStats run(uint64_t steps, double seconds = 0);
+
+	unsigned int threads() const {
+		return thread_count;
+	}
+
+	// Cells in the order they were found; not to be read while run() is going.
+	size_t size() const {
+		return cells.size();
+	}
+	const ExploreCell& cell(size_t i) const {
+		return cells[i];
+	}
+
+	// The key mask of every frame from boot to cell i's state.
+	std::vector<uint16_t> route(size_t i) const;
+	// The same as a movie that chip8-run --replay plays back to cell i's state.
+	Movie movie(size_t i) const;
+
+private:
+	ExploreConfig config;
+	unsigned int thread_count;
+	uint64_t rom_hash = 0;
+	// No key, then each key the config allows.
+	std::vector<uint16_t> choices;
+
+	// Guards everything below.
+	std::mutex lock;
+	std::deque<ExploreCell> cells;
+	std::unordered_map<uint64_t, uint32_t> index;
+	// Selection weights, and their Fenwick tree so picking and reweighting a cell are O(log n).
+	std::vector<uint64_t> weights;
+	std::vector<uint64_t> tree;
+	uint64_t total_weight = 0;
+
+	void add(ExploreCell cell);
+	void reweight(size_t i);
+	// The cell at `target` in [0, total weight).
+	size_t pick(uint64_t target) const;
+
+	struct Scratch;
+	void step(Xorshift64& random, Scratch& scratch, ExploreStats& stats);
+	uint16_t next_keys(Xorshift64& random, uint16_t held) const;
+	// True if the frame ends in an idle loop.
+	bool run_frame(Chip8& chip8, uint16_t keys) const;
+};
+
+#endif // !EXPLORE
@@ -0,0 +1,162 @@
+#include "fleet.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "hash.h"
+
+namespace {
+
+struct InputEvent {
+	uint64_t frame;
+	uint16_t keys;
+};
+
+bool load_input(const std::string& filename, std::vector<InputEvent>& events)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		InputEvent event;
+		unsigned int mask;
+		if (!(fields >> event.frame))
+			continue;
+		if (!(fields >> std::hex >> mask) || mask > 0xFFFFu)
+			return false;
+		event.keys = static_cast<uint16_t>(mask);
+		events.push_back(event);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const InputEvent& a, const InputEvent& b) {
+		return a.frame < b.frame;
+	});
+	return true;
+}
+
+// A worker's share of the job list. Jobs are whole emulator runs, so a lock per queue costs nothing
+// measurable; the padding keeps neighbouring queues off each other's cache lines.
+struct JobQueue {
+	std::mutex lock;
+	std::deque<size_t> jobs;
+	char padding[64];
+
+	bool pop(size_t& job) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return false;
+		job = jobs.front();
+		jobs.pop_front();
+		return true;
+	}
+	bool steal(size_t& job) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return false;
+		job = jobs.back();
+		jobs.pop_back();
+		return true;
+	}
+};
+
+}
+
+Fleet::Fleet(unsigned int threads) : thread_count(threads)
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+}
+
+uint64_t Fleet::hash_video(const uint64_t* video)
+{
+	// Each row's bytes left to right, as the display shows them.
+	uint64_t hash = FNV_OFFSET;
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++) {
+		uint8_t bytes[8];
+		for (unsigned int i = 0; i < 8; i++)
+			bytes[i] = static_cast<uint8_t>(video[row] >> (56u - 8u * i));
+		hash = fnv1a(bytes, sizeof(bytes), hash);
+	}
+	return hash;
+}
+
+FleetResult Fleet::run_job(const FleetJob& job)
+{
+	FleetResult result;
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<InputEvent> events;
+	if (!job.input.empty() && !load_input(job.input, events))
+		return result;
+
+	Chip8 chip8(job.seed);
+	if (job.rate == 0 || !chip8.LoadROM(job.rom.c_str()))
+		return result;
+
+	size_t next_event = 0;
+	uint64_t executed = 0;
+	for (uint64_t frame = 0; executed < job.cycles; frame++) {
+		while (next_event < events.size() && events[next_event].frame <= frame)
+			chip8.set_keys(events[next_event++].keys);
+
+		uint64_t batch = std::min<uint64_t>(job.cycles - executed, job.rate);
+		for (uint64_t i = chip8.skip_idle(batch); i < batch; i++)
+			chip8.cycle();
+		executed += batch;
+
+		if (batch == job.rate)
+			chip8.tick_timers();
+	}
+
+	result.ok = true;
+	result.video_hash = hash_video(chip8.get_video());
+	result.cycles = executed;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+std::vector<FleetResult> Fleet::run(const std::vector<FleetJob>& jobs)
+{
+	std::vector<FleetResult> results(jobs.size());
+	unsigned int workers = static_cast<unsigned int>(std::min<size_t>(thread_count, std::max<size_t>(jobs.size(), 1)));
+	std::unique_ptr<JobQueue[]> queues(new JobQueue[workers]);
+
+	// Contiguous shares keep jobs on the same ROM together; stealing from the back leaves an owner's
+	// next jobs alone.
+	for (unsigned int w = 0; w < workers; w++) {
+		size_t begin = jobs.size() * w / workers;
+		size_t end = jobs.size() * (w + 1) / workers;
+		for (size_t i = begin; i < end; i++)
+			queues[w].jobs.push_back(i);
+	}
+
+	auto work = [&](unsigned int self) {
+		for (;;) {
+			size_t job;
+			bool found = queues[self].pop(job);
+			// No job ever adds work, so one empty pass over every queue means the run is done.
+			for (unsigned int i = 1; !found && i < workers; i++)
+				found = queues[(self + i) % workers].steal(job);
+			if (!found)
+				return;
+
+			results[job] = run_job(jobs[job]);
+			results[job].worker = self;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int w = 1; w < workers; w++)
+		threads.emplace_back(work, w);
+	work(0);
+	for (auto& thread : threads)
+		thread.join();
+
+	return results;
+}
@@ -0,0 +1,52 @@
+#ifndef FLEET
+#define FLEET
+#include <string>
+#include <vector>
+#include "cpu.h"
+
+// One headless run: a ROM booted with `seed`, driven by an optional input script for `cycles` instructions,
+// with the timers ticking once every `rate` cycles as in chip8-run.
+struct FleetJob {
+	std::string rom;
+	uint64_t seed = 0;
+	// Empty for no input. Each line is "<frame> <hex key mask>": the mask is held from that frame on.
+	std::string input;
+	uint64_t cycles = 6000;
+	unsigned int rate = 10;
+};
+
+struct FleetResult {
+	// False if the ROM or the input script could not be loaded; the other fields are then zero.
+	bool ok = false;
+	uint64_t video_hash = 0;
+	uint64_t cycles = 0;
+	double seconds = 0;
+	unsigned int worker = 0;
+};
+
+// Runs jobs across a pool of threads, one Chip8 per job. Each worker starts with a contiguous share of the
+// job list and, once that runs dry, steals from the far end of another worker's share, so uneven jobs
+// still keep every thread busy.
+class Fleet {
+public:
+	// 0 uses every hardware thread.
+	explicit Fleet(unsigned int threads = 0);
+
+	unsigned int threads() const {
+		return thread_count;
+	}
+
+	// Results are in job order.
+	std::vector<FleetResult> run(const std::vector<FleetJob>& jobs);
+
+	// Runs a single job on the calling thread.
+	static FleetResult run_job(const FleetJob& job);
+
+	// FNV-1a over the framebuffer rows.
+	static uint64_t hash_video(const uint64_t* video);
+
+private:
+	unsigned int thread_count;
+};
+
+#endif // !FLEET
@@ -0,0 +1,16 @@
+#ifndef HASH
+#define HASH
+#include <cstddef>
+#include <cstdint>
+
+const uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+
+// FNV-1a over `size` bytes, continuing from `hash`: a stable fingerprint for ROMs and frames, not a mixer.
+inline uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = FNV_OFFSET)
+{
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 0x100000001B3ull;
+	return hash;
+}
+
+#endif // !HASH
@@ -0,0 +1,462 @@
+#include "jit.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64 1
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace {
+
+// Appends x86-64 machine code to a fixed buffer. Guest state is addressed as [rbx + disp32], with rbx
+// holding the Chip8 pointer for the whole block.
+class Emitter {
+public:
+	Emitter(uint8_t* start, size_t capacity) : start(start), cursor(start), end(start + capacity) {}
+
+	bool overflowed() const {
+		return overflow;
+	}
+	size_t size() const {
+		return cursor - start;
+	}
+
+	void byte(uint8_t value) {
+		if (cursor < end)
+			*cursor++ = value;
+		else
+			overflow = true;
+	}
+	void bytes(std::initializer_list<uint8_t> values) {
+		for (uint8_t value : values)
+			byte(value);
+	}
+	void imm16(uint16_t value) {
+		byte(value & 0xFFu);
+		byte(value >> 8u);
+	}
+	void imm32(uint32_t value) {
+		for (int i = 0; i < 4; i++)
+			byte((value >> (8 * i)) & 0xFFu);
+	}
+	void imm64(uint64_t value) {
+		for (int i = 0; i < 8; i++)
+			byte((value >> (8 * i)) & 0xFFu);
+	}
+
+	// op r8/r16, [rbx + disp32] with the register in ModRM.reg
+	void mem(std::initializer_list<uint8_t> opcode, uint8_t reg, uint32_t disp) {
+		bytes(opcode);
+		byte(0x83u | (reg << 3u));
+		imm32(disp);
+	}
+
+	// A jump with a rel32 to be set by land(); returns where the rel32 is.
+	size_t jump(std::initializer_list<uint8_t> opcode) {
+		bytes(opcode);
+		size_t at = size();
+		imm32(0);
+		return at;
+	}
+	// Points the jump whose rel32 is at `at` here.
+	void land(size_t at) {
+		if (overflow)
+			return;
+		uint32_t rel = static_cast<uint32_t>(size() - at - 4u);
+		for (int i = 0; i < 4; i++)
+			start[at + i] = (rel >> (8 * i)) & 0xFFu;
+	}
+
+private:
+	uint8_t* start;
+	uint8_t* cursor;
+	uint8_t* end;
+	bool overflow = false;
+};
+
+const uint8_t AL = 0;
+const uint8_t CL = 1;
+const uint8_t DL = 2;
+
+}
+
+Chip8Jit::Chip8Jit(Chip8& chip8) : chip8(chip8)
+{
+#ifdef JIT_X64
+#ifdef _WIN32
+	void* memory = VirtualAlloc(nullptr, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	code = static_cast<uint8_t*>(memory);
+#else
+	void* memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+#endif
+#endif
+}
+
+Chip8Jit::~Chip8Jit()
+{
+#ifdef JIT_X64
+	if (code) {
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, CODE_SIZE);
+#endif
+	}
+#endif
+}
+
+void Chip8Jit::flush()
+{
+	for (auto& block : blocks)
+		block = Block{};
+	for (auto& count : code_lines)
+		count = 0;
+	code_used = 0;
+}
+
+void Chip8Jit::call_handler(Chip8* chip8, const Chip8::Instruction* entry)
+{
+	chip8->instr = entry;
+	chip8->opcode = entry->opcode;
+	((*chip8).*(entry->func))();
+}
+
+bool Chip8Jit::call_store(Chip8Jit* jit, const Chip8::Instruction* entry)
+{
+	call_handler(&jit->chip8, entry);
+	unsigned int length = (entry->opcode & 0xF0FFu) == 0xF033u ? 3 : entry->x + 1u;
+	return jit->invalidate(jit->chip8.index, length);
+}
+
+void Chip8Jit::step()
+{
+	chip8.cycle();
+
+	uint16_t op = chip8.opcode & 0xF0FFu;
+	if (op == 0xF033u)
+		invalidate(chip8.index, 3);
+	else if (op == 0xF055u)
+		invalidate(chip8.index, ((chip8.opcode & 0x0F00u) >> 8u) + 1);
+}
+
+bool Chip8Jit::invalidate(uint16_t address, unsigned int length)
+{
+	unsigned int first = address & 0xFFFu;
+	unsigned int last = first + length;
+
+	bool translated = false;
+	for (unsigned int line = first / CODE_LINE_SIZE; line <= (last - 1u) / CODE_LINE_SIZE; line++)
+		translated |= code_lines[line % (MEMORY_SIZE / CODE_LINE_SIZE)] != 0;
+	if (!translated)
+		return false;
+
+	if (last <= MEMORY_SIZE)
+		return drop_blocks(first, last);
+	bool dropped = drop_blocks(first, MEMORY_SIZE);
+	return drop_blocks(0, last - MEMORY_SIZE) || dropped;
+}
+
+bool Chip8Jit::drop_blocks(unsigned int first, unsigned int last)
+{
+	// Blocks never wrap, and one covering the write starts at most MAX_BLOCK_LENGTH instructions before it.
+	bool dropped = false;
+	unsigned int start = first < MAX_BLOCK_LENGTH * 2 ? 0 : first - MAX_BLOCK_LENGTH * 2;
+	for (; start < last; start++) {
+		Block& block = blocks[start];
+		if (block.code && start + block.length * 2u > first) {
+			count_lines(static_cast<uint16_t>(start), block, -1);
+			block = Block{};
+			dropped = true;
+		}
+	}
+	return dropped;
+}
+
+void Chip8Jit::count_lines(uint16_t start, const Block& block, int delta)
+{
+	unsigned int last = start + block.length * 2u - 1u;
+	for (unsigned int line = start / CODE_LINE_SIZE; line <= last / CODE_LINE_SIZE; line++)
+		code_lines[line] = static_cast<uint16_t>(code_lines[line] + delta);
+}
+
+void Chip8Jit::run(uint64_t cycles)
+{
+	while (cycles) {
+		uint16_t pc = chip8.pc;
+		Block* block = nullptr;
+
+		if (code && pc < MEMORY_SIZE - 1) {
+			block = blocks[pc].code ? &blocks[pc] : translate(pc);
+			if (!block) {
+				flush();
+				block = translate(pc);
+			}
+		}
+
+		// Where nothing could be translated, single-step so the count stays exact.
+		if (!block) {
+			step();
+			cycles--;
+			continue;
+		}
+
+		cycles -= block->code(&chip8, cycles < block->length ? static_cast<unsigned int>(cycles) : block->length);
+	}
+}
+
+Chip8Jit::Block* Chip8Jit::translate(uint16_t start)
+{
+#ifdef JIT_X64
+	Emitter e(code + code_used, CODE_SIZE - code_used);
+
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(&chip8);
+	auto V = [&](uint8_t reg) {
+		return static_cast<uint32_t>(&chip8.registers[reg] - base);
+	};
+	const uint32_t INDEX = static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(&chip8.index) - base);
+	const uint32_t PC = static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(&chip8.pc) - base);
+	const uint32_t DELAY = static_cast<uint32_t>(&chip8.delay_timer - base);
+	const uint32_t SOUND = static_cast<uint32_t>(&chip8.sound_timer - base);
+
+#ifdef _WIN32
+	const uint8_t MOV_ARG0_RBX[] = { 0x48, 0x89, 0xD9 };
+	const uint8_t MOV_ARG0_IMM64[] = { 0x48, 0xB9 };
+	const uint8_t MOV_ARG1_IMM64[] = { 0x48, 0xBA };
+	const uint8_t MOV_RBX_ARG0[] = { 0x48, 0x89, 0xCB };
+	const uint8_t MOV_R12D_ARG1[] = { 0x41, 0x89, 0xD4 };
+#else
+	const uint8_t MOV_ARG0_RBX[] = { 0x48, 0x89, 0xDF };
+	const uint8_t MOV_ARG0_IMM64[] = { 0x48, 0xBF };
+	const uint8_t MOV_ARG1_IMM64[] = { 0x48, 0xBE };
+	const uint8_t MOV_RBX_ARG0[] = { 0x48, 0x89, 0xFB };
+	const uint8_t MOV_R12D_ARG1[] = { 0x41, 0x89, 0xF4 };
+#endif
+
+	auto store_pc = [&](uint16_t value) {
+		e.mem({ 0x66, 0xC7 }, 0, PC);
+		e.imm16(value);
+	};
+	auto call = [&](const Chip8::Instruction* entry) {
+		e.bytes({ MOV_ARG0_RBX[0], MOV_ARG0_RBX[1], MOV_ARG0_RBX[2] });
+		e.bytes({ MOV_ARG1_IMM64[0], MOV_ARG1_IMM64[1] });
+		e.imm64(reinterpret_cast<uint64_t>(entry));
+		e.bytes({ 0x48, 0xB8 });
+		e.imm64(reinterpret_cast<uint64_t>(&Chip8Jit::call_handler));
+		e.bytes({ 0xFF, 0xD0 });
+	};
+	// eax = instructions run; add rsp, 40; pop r12; pop rbx; ret
+	auto leave = [&](uint16_t ran) {
+		e.byte(0xB8);
+		e.imm32(ran);
+		e.bytes({ 0x48, 0x83, 0xC4, 0x28, 0x41, 0x5C, 0x5B, 0xC3 });
+	};
+
+	// Ways out part way through, emitted after the block: the jump to them, where to resume and instructions run.
+	struct Exit {
+		size_t jump;
+		uint16_t pc;
+		uint16_t ran;
+	};
+	Exit exits[MAX_BLOCK_LENGTH * 2];
+	unsigned int exit_count = 0;
+
+	// pc = condition ? skip : next, where cmov_opcode is the second byte of the cmovcc
+	auto skip_if = [&](uint8_t cmov_opcode, uint16_t next) {
+		e.byte(0xB8);
+		e.imm32(next);
+		e.byte(0xB9);
+		e.imm32(next + 2u);
+		e.bytes({ 0x0F, cmov_opcode, 0xC1 });
+		e.mem({ 0x66, 0x89 }, AL, PC);
+	};
+
+	// push rbx; push r12; sub rsp, 40 keeps the stack 16-byte aligned and leaves Win64 its shadow space.
+	// r12d holds the budget for the whole block.
+	e.bytes({ 0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x28 });
+	e.bytes({ MOV_RBX_ARG0[0], MOV_RBX_ARG0[1], MOV_RBX_ARG0[2] });
+	e.bytes({ MOV_R12D_ARG1[0], MOV_R12D_ARG1[1], MOV_R12D_ARG1[2] });
+
+	uint16_t address = start;
+	uint16_t length = 0;
+	bool ended = false;
+	bool pc_written = false;
+
+	while (!ended && length < MAX_BLOCK_LENGTH && address < MEMORY_SIZE - 1) {
+		Chip8::Instruction& entry = decoded[address];
+		chip8.decode(chip8.fetch(address), entry);
+
+		Chip8::Chip8Func f = entry.func;
+		uint8_t x = entry.x;
+		uint8_t y = entry.y;
+		uint16_t next = address + 2;
+
+		// cmp r12d, length; jbe out, when the budget is already spent
+		if (length) {
+			e.bytes({ 0x41, 0x83, 0xFC, static_cast<uint8_t>(length) });
+			exits[exit_count++] = { e.jump({ 0x0F, 0x86 }), address, length };
+		}
+
+		length++;
+
+		if (f == &Chip8::OP_6XKK) {
+			e.mem({ 0xC6 }, 0, V(x));
+			e.byte(entry.kk);
+		}
+		else if (f == &Chip8::OP_7XKK) {
+			e.mem({ 0x80 }, 0, V(x));
+			e.byte(entry.kk);
+		}
+		else if (f == &Chip8::OP_8XY0) {
+			e.mem({ 0x8A }, AL, V(y));
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_8XY1 || f == &Chip8::OP_8XY2 || f == &Chip8::OP_8XY3) {
+			uint8_t op = f == &Chip8::OP_8XY1 ? 0x08 : f == &Chip8::OP_8XY2 ? 0x20 : 0x30;
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x8A }, CL, V(y));
+			e.bytes({ op, 0xC8 });
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_8XY4) {
+			// Both operands are read before VF is written, and Vx is stored last.
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x8A }, CL, V(y));
+			e.bytes({ 0x00, 0xC8 });
+			e.bytes({ 0x0F, 0x92, 0xC2 });
+			e.mem({ 0x88 }, DL, V(0xF));
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_8XY5 || f == &Chip8::OP_8XY7) {
+			// The interpreter writes VF first and then re-reads both operands, which matters when X or Y is F.
+			bool reverse = f == &Chip8::OP_8XY7;
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x8A }, CL, V(y));
+			e.bytes({ 0x38, static_cast<uint8_t>(reverse ? 0xC1 : 0xC8) });
+			e.bytes({ 0x0F, 0x97, 0xC2 });
+			e.mem({ 0x88 }, DL, V(0xF));
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x8A }, CL, V(y));
+			if (reverse) {
+				e.bytes({ 0x28, 0xC1 });
+				e.mem({ 0x88 }, CL, V(x));
+			}
+			else {
+				e.bytes({ 0x28, 0xC8 });
+				e.mem({ 0x88 }, AL, V(x));
+			}
+		}
+		else if (f == &Chip8::OP_8XY6) {
+			e.mem({ 0x8A }, AL, V(x));
+			e.bytes({ 0x24, 0x01 });
+			e.mem({ 0x88 }, AL, V(0xF));
+			e.mem({ 0x8A }, AL, V(x));
+			e.bytes({ 0xD0, 0xE8 });
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_8XYE) {
+			e.mem({ 0x8A }, AL, V(x));
+			e.bytes({ 0xC0, 0xE8, 0x07 });
+			e.mem({ 0x88 }, AL, V(0xF));
+			e.mem({ 0x8A }, AL, V(x));
+			e.bytes({ 0x00, 0xC0 });
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_ANNN) {
+			e.mem({ 0x66, 0xC7 }, 0, INDEX);
+			e.imm16(entry.nnn);
+		}
+		else if (f == &Chip8::OP_FX1E) {
+			e.mem({ 0x0F, 0xB6 }, AL, V(x));
+			e.mem({ 0x66, 0x01 }, AL, INDEX);
+		}
+		else if (f == &Chip8::OP_FX29) {
+			// index = 0x50 + 5 * Vx
+			e.mem({ 0x0F, 0xB6 }, AL, V(x));
+			e.bytes({ 0x8D, 0x44, 0x80, 0x50 });
+			e.mem({ 0x66, 0x89 }, AL, INDEX);
+		}
+		else if (f == &Chip8::OP_FX07) {
+			e.mem({ 0x8A }, AL, DELAY);
+			e.mem({ 0x88 }, AL, V(x));
+		}
+		else if (f == &Chip8::OP_FX15 || f == &Chip8::OP_FX18) {
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x88 }, AL, f == &Chip8::OP_FX15 ? DELAY : SOUND);
+		}
+		else if (f == &Chip8::OP_NULL) {
+		}
+		else if (f == &Chip8::OP_1NNN) {
+			store_pc(entry.nnn);
+			ended = pc_written = true;
+		}
+		else if (f == &Chip8::OP_3XKK || f == &Chip8::OP_4XKK) {
+			e.mem({ 0x80 }, 7, V(x));
+			e.byte(entry.kk);
+			skip_if(f == &Chip8::OP_3XKK ? 0x44 : 0x45, next);
+			ended = pc_written = true;
+		}
+		else if (f == &Chip8::OP_5XY0 || f == &Chip8::OP_9XY0) {
+			e.mem({ 0x8A }, AL, V(x));
+			e.mem({ 0x3A }, AL, V(y));
+			skip_if(f == &Chip8::OP_5XY0 ? 0x44 : 0x45, next);
+			ended = pc_written = true;
+		}
+		else if (f == &Chip8::OP_00E0 || f == &Chip8::OP_CXKK || f == &Chip8::OP_DXYN || f == &Chip8::OP_FX65) {
+			call(&entry);
+		}
+		else if (f == &Chip8::OP_FX33 || f == &Chip8::OP_FX55) {
+			// Carries on unless the write dropped a block, which may be this one.
+			e.bytes({ MOV_ARG0_IMM64[0], MOV_ARG0_IMM64[1] });
+			e.imm64(reinterpret_cast<uint64_t>(this));
+			e.bytes({ MOV_ARG1_IMM64[0], MOV_ARG1_IMM64[1] });
+			e.imm64(reinterpret_cast<uint64_t>(&entry));
+			e.bytes({ 0x48, 0xB8 });
+			e.imm64(reinterpret_cast<uint64_t>(&Chip8Jit::call_store));
+			e.bytes({ 0xFF, 0xD0 });
+			// test al, al; jnz out
+			e.bytes({ 0x84, 0xC0 });
+			exits[exit_count++] = { e.jump({ 0x0F, 0x85 }), next, length };
+		}
+		else {
+			// 2NNN, 00EE, BNNN, EX9E, EXA1 and FX0A set pc themselves, relative to the next instruction.
+			store_pc(next);
+			call(&entry);
+			ended = pc_written = true;
+		}
+
+		address = next;
+	}
+
+	if (!length)
+		return nullptr;
+
+	if (!pc_written)
+		store_pc(address);
+	leave(length);
+
+	for (unsigned int i = 0; i < exit_count; i++) {
+		e.land(exits[i].jump);
+		store_pc(exits[i].pc);
+		leave(exits[i].ran);
+	}
+
+	if (e.overflowed())
+		return nullptr;
+
+	Block& block = blocks[start];
+	block.code = reinterpret_cast<BlockFunc>(code + code_used);
+	block.length = length;
+	count_lines(start, block, 1);
+	code_used += e.size();
+
+	return &block;
+#else
+	(void)start;
+	return nullptr;
+#endif
+}
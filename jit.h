@@ -0,0 +1,62 @@
+#ifndef JIT
+#define JIT
+#include "cpu.h"
+
+// Optional x86-64 dynamic recompiler for a Chip8 instance. Straight-line runs of instructions starting
+// at pc are translated into native blocks; DXYN, FX0A, the key opcodes and the other instructions that
+// touch the display, RNG, stack or memory call back into the interpreter's OP_* handlers. On other
+// hosts, or if executable memory can't be mapped, run() falls back to Chip8::cycle.
+class Chip8Jit {
+public:
+	explicit Chip8Jit(Chip8& chip8);
+	~Chip8Jit();
+
+	Chip8Jit(const Chip8Jit&) = delete;
+	Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+	bool available() const {
+		return code != nullptr;
+	}
+
+	// Executes exactly `cycles` instructions, the same as calling Chip8::cycle that many times.
+	void run(uint64_t cycles);
+
+	// Drops every translated block. Call after replacing memory behind the JIT's back, e.g. LoadROM or load_state.
+	void flush();
+
+private:
+	// Runs at most `budget` instructions and returns how many it ran: fewer if a store dropped a block.
+	typedef unsigned int (*BlockFunc)(Chip8* chip8, unsigned int budget);
+
+	struct Block {
+		BlockFunc code;
+		uint16_t length;
+	};
+
+	static const unsigned int MAX_BLOCK_LENGTH = 64;
+	static const unsigned int CODE_LINE_SIZE = 16;
+	static const size_t CODE_SIZE = 1 << 20;
+
+	Chip8& chip8;
+	uint8_t* code{};
+	size_t code_used{};
+	Block blocks[MEMORY_SIZE]{};
+	// Operands for the handlers called from translated code; their addresses are baked into the blocks.
+	Chip8::Instruction decoded[MEMORY_SIZE]{};
+	// Translated blocks overlapping each line of memory, so a write to lines without any costs one check.
+	uint16_t code_lines[MEMORY_SIZE / CODE_LINE_SIZE]{};
+
+	Block* translate(uint16_t start);
+	// Drops the blocks over `length` bytes from `address`, wrapping at the end of memory as Chip8::write does.
+	// True if any were dropped.
+	bool invalidate(uint16_t address, unsigned int length);
+	bool drop_blocks(unsigned int first, unsigned int last);
+	void count_lines(uint16_t start, const Block& block, int delta);
+	void step();
+
+	static void call_handler(Chip8* chip8, const Chip8::Instruction* entry);
+	// Runs an FX33 or FX55 from translated code; true if its write dropped a block, which ends the running one.
+	static bool call_store(Chip8Jit* jit, const Chip8::Instruction* entry);
+};
+
+#endif // !JIT
@@ -1,13 +1,26 @@
 #include <Windows.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <functional>
 #include <thread>
 #include <stdint.h>
 #include <SDL.h>
 #include "cpu.h"
+#include "movie.h"
+#include "rewind.h"
+#include "timeline.h"
+#include "triple_buffer.h"
 #include <imgui.h>
 #include <imgui_impl_sdl2.h>
 #include <imgui_impl_sdlrenderer2.h>
 
+#pragma comment(lib, "winmm.lib")
+
 uint8_t keymap[16] = {
     SDLK_x, SDLK_1, SDLK_2, SDLK_3,
     SDLK_q, SDLK_w, SDLK_e, SDLK_a,
@@ -15,6 +28,155 @@ uint8_t keymap[16] = {
     SDLK_4, SDLK_r, SDLK_f, SDLK_v,
 };
 
+const std::chrono::steady_clock::duration FRAME_DURATION = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / 60.0));
+
+// Sleeps through most of the wait and only spins for the last millisecond, which sleep can't hit precisely.
+void wait_until(std::chrono::steady_clock::time_point deadline) {
+    const auto margin = std::chrono::milliseconds(1);
+
+    auto now = std::chrono::steady_clock::now();
+    if (deadline - now > margin)
+        std::this_thread::sleep_for(deadline - now - margin);
+
+    while (std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+// Moves the deadline on one frame and waits for it. After a long stall (window drag, breakpoint) it
+// resynchronises instead of running frames back to back.
+void wait_next_frame(std::chrono::steady_clock::time_point& next_frame) {
+    next_frame += FRAME_DURATION;
+    if (std::chrono::steady_clock::now() - next_frame > FRAME_DURATION)
+        next_frame = std::chrono::steady_clock::now();
+    wait_until(next_frame);
+}
+
+// Everything the render thread needs from one emulated frame.
+struct Frame {
+    uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    uint8_t sound_timer;
+    std::vector<std::string> register_info;
+    Chip8::TraceEntry trace[TRACE_CAPACITY];
+    unsigned int trace_size;
+    // Executions per address while the heatmap is on, empty while it is off.
+    std::vector<uint64_t> heat;
+};
+
+// Set from the render thread, acted on by the emulation thread at its next frame.
+struct HeatmapControl {
+    std::atomic<bool> enabled{ false };
+    std::atomic<bool> reset{ false };
+};
+
+// Runs on its own thread so a slow present or vsync stall never delays emulation. Keys come in
+// through an atomic mask, finished frames go out through the triple buffer. Changed rows are or-ed into
+// `dirty` only after their frame is published, so rows the render thread sees are always in a frame it
+// can read. When `movie` is set, every change of the keys is recorded into it.
+void emulate(Chip8& chip8, int cycles_per_frame, std::atomic<uint16_t>& keys, std::atomic<bool>& running, TripleBuffer<Frame>& frames, std::atomic<uint32_t>& dirty, HeatmapControl& heatmap, std::atomic<bool>& rewinding, Movie* movie) {
+    auto next_frame = std::chrono::steady_clock::now();
+    AddressProfile profile;
+    // 60 seconds of frames.
+    Rewind rewind(3600);
+    Timeline::name_thread("emulation");
+    uint64_t executed = 0;
+
+    while (running.load(std::memory_order_relaxed)) {
+        uint16_t held = keys.load(std::memory_order_relaxed);
+        chip8.set_keys(held);
+
+        if (heatmap.reset.exchange(false, std::memory_order_relaxed))
+            profile.reset();
+        bool profiling = heatmap.enabled.load(std::memory_order_relaxed);
+
+        // While rewind is held, each frame steps back one captured frame instead of running; at the oldest it stays put.
+        if (rewinding.load(std::memory_order_relaxed)) {
+            TimelineZone rewind_zone("rewind");
+            if (rewind.step_back(chip8)) {
+                executed -= cycles_per_frame;
+                // The frames stepped over never happened as far as the movie is concerned.
+                if (movie)
+                    movie->truncate(executed);
+            }
+        }
+        else {
+            if (movie)
+                movie->record(executed, held);
+
+            // Menus and title screens spend most frames waiting on a key or the delay timer; skip those cycles.
+            TimelineZone emulate_zone("emulate");
+            uint64_t i = chip8.skip_idle(cycles_per_frame);
+            if (profiling) {
+                for (; i < static_cast<uint64_t>(cycles_per_frame); i++)
+                    chip8.cycle(profile);
+            }
+            else {
+                for (; i < static_cast<uint64_t>(cycles_per_frame); i++)
+                    chip8.cycle();
+            }
+            chip8.tick_timers();
+            emulate_zone.end();
+            executed += cycles_per_frame;
+
+            TimelineZone capture_zone("capture");
+            rewind.capture(chip8);
+        }
+
+        Frame& frame = frames.write_buffer();
+        chip8.expand_video(frame.pixels);
+        frame.sound_timer = chip8.get_soundtimer();
+        TimelineZone registers_zone("print_registers");
+        chip8.print_registers(frame.register_info);
+        registers_zone.end();
+        frame.trace_size = chip8.trace_size();
+        for (unsigned int i = 0; i < frame.trace_size; i++)
+            frame.trace[i] = chip8.trace_at(i);
+        if (profiling)
+            frame.heat.assign(profile.get_counts(), profile.get_counts() + AddressProfile::ADDRESSES);
+        else
+            frame.heat.clear();
+        frames.publish();
+        dirty.fetch_or(chip8.take_dirty_rows(), std::memory_order_release);
+
+        wait_next_frame(next_frame);
+    }
+
+    if (movie)
+        movie->length = executed;
+}
+
+// One cell per address, 128 to a row, coloured from dark blue through red to yellow on a log scale up to
+// the hottest address. Hovering shows the address and its count.
+void draw_heatmap(const uint64_t* counts) {
+    const unsigned int COLUMNS = 128;
+    const unsigned int ROWS = AddressProfile::ADDRESSES / COLUMNS;
+    const float CELL_WIDTH = 5.0f;
+    const float CELL_HEIGHT = 4.0f;
+
+    uint64_t hottest = *std::max_element(counts, counts + AddressProfile::ADDRESSES);
+    double scale = hottest ? 1.0 / std::log1p(static_cast<double>(hottest)) : 0.0;
+
+    ImDrawList* draw = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    for (unsigned int address = 0; address < AddressProfile::ADDRESSES; address++) {
+        ImU32 colour = IM_COL32(20, 20, 20, 255);
+        if (counts[address]) {
+            float t = static_cast<float>(std::log1p(static_cast<double>(counts[address])) * scale);
+            colour = IM_COL32(static_cast<int>(255 * std::min(1.0f, 2 * t)), static_cast<int>(255 * std::max(0.0f, 2 * t - 1)), static_cast<int>(160 * (1 - t)), 255);
+        }
+        ImVec2 min(origin.x + (address % COLUMNS) * CELL_WIDTH, origin.y + (address / COLUMNS) * CELL_HEIGHT);
+        draw->AddRectFilled(min, ImVec2(min.x + CELL_WIDTH, min.y + CELL_HEIGHT), colour);
+    }
+
+    ImGui::InvisibleButton("map", ImVec2(COLUMNS * CELL_WIDTH, ROWS * CELL_HEIGHT));
+    if (ImGui::IsItemHovered()) {
+        ImVec2 mouse = ImGui::GetIO().MousePos;
+        unsigned int column = std::min(COLUMNS - 1, static_cast<unsigned int>(std::max(0.0f, mouse.x - origin.x) / CELL_WIDTH));
+        unsigned int row = std::min(ROWS - 1, static_cast<unsigned int>(std::max(0.0f, mouse.y - origin.y) / CELL_HEIGHT));
+        unsigned int address = row * COLUMNS + column;
+        ImGui::SetTooltip("%03X: %llu", address, static_cast<unsigned long long>(counts[address]));
+    }
+}
+
 void audio_callback(void* userdata, uint8_t* stream, int len) {
     for (int i = 0; i < len; i++)
         stream[i] = (i / 128) % 2 == 0 ? 127 : -128;
@@ -22,6 +184,8 @@ void audio_callback(void* userdata, uint8_t* stream, int len) {
 
 int main(int argc, char* args[]) {
     ShowWindow(GetConsoleWindow(), false);
+    // Raise the scheduler resolution so sleep_for in wait_until is accurate to about 1 ms.
+    timeBeginPeriod(1);
 
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
@@ -84,19 +248,63 @@ int main(int argc, char* args[]) {
         return -1;
     }
 
-    Chip8 chip8;
-    std::vector<std::string> instructions;
-    chip8.LoadROM("tetris.ch8");
+    const char* rom = argc > 1 ? args[1] : "tetris.ch8";
+    int cycles_per_frame = argc > 2 ? atoi(args[2]) : 10;
+    if (cycles_per_frame <= 0)
+        cycles_per_frame = 10;
 
-    auto last_cycle = std::chrono::high_resolution_clock::now();
-    bool running = true;
+    // --trace FILE records frame phases, written on exit or whenever F12 is pressed. --record FILE saves the
+    // session's key presses as a movie on exit.
+    const char* trace_file = nullptr;
+    const char* movie_file = nullptr;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (!strcmp(args[i], "--trace"))
+            trace_file = args[i + 1];
+        else if (!strcmp(args[i], "--record"))
+            movie_file = args[i + 1];
+    }
+    if (trace_file) {
+        Timeline::start();
+        Timeline::name_thread("render");
+    }
 
-    std::vector<std::string> register_info;
+    // The seed is picked here rather than by Chip8 so a movie can record it.
+    uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
+    Chip8 chip8(seed);
+    chip8.LoadROM(rom);
+
+    Movie movie;
+    movie.seed = seed;
+    movie.cycles_per_frame = cycles_per_frame;
+    if (movie_file && !Movie::hash_rom(rom, movie.rom_hash))
+        movie_file = nullptr;
+    chip8.set_tracing(true);
+
+    std::atomic<bool> running(true);
+    std::atomic<uint16_t> keys(0);
+    TripleBuffer<Frame> frames;
+    // Every row starts dirty so the first frame uploads the whole texture.
+    std::atomic<uint32_t> dirty(0xFFFFFFFFu);
+    HeatmapControl heatmap;
+    std::atomic<bool> rewinding(false);
+
+    std::thread emulation(emulate, std::ref(chip8), cycles_per_frame, std::ref(keys), std::ref(running), std::ref(frames), std::ref(dirty), std::ref(heatmap), std::ref(rewinding), movie_file ? &movie : nullptr);
+
+    auto next_frame = std::chrono::steady_clock::now();
+
+    // What the last presented frame showed in the side panels, to tell whether a new frame changes anything.
+    std::vector<std::string> shown_registers;
+    Chip8::TraceEntry shown_trace[TRACE_CAPACITY];
+    unsigned int shown_trace_size = 0;
+    bool redraw = true;
 
-    while (running) {
+    while (running.load(std::memory_order_relaxed)) {
+        TimelineZone events_zone("events");
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             ImGui_ImplSDL2_ProcessEvent(&e);
+            // Input, resizes and exposes all need ImGui to run.
+            redraw = true;
 
             if (e.type == SDL_QUIT) {
                 running = false;
@@ -105,79 +313,150 @@ int main(int argc, char* args[]) {
                 if (e.key.keysym.sym == SDLK_ESCAPE) {
                     running = false;
                 }
+                if (e.key.keysym.sym == SDLK_F12 && trace_file) {
+                    Timeline::write(trace_file);
+                }
+                if (e.key.keysym.sym == SDLK_BACKSPACE) {
+                    rewinding.store(true, std::memory_order_relaxed);
+                }
                 for (int i = 0; i < 16; i++) {
                     if (e.key.keysym.sym == keymap[i]) {
-                        chip8.keypad[i] = 1;
+                        keys.fetch_or(static_cast<uint16_t>(1u << i), std::memory_order_relaxed);
                     }
                 }
             }
             if (e.type == SDL_KEYUP) {
+                if (e.key.keysym.sym == SDLK_BACKSPACE) {
+                    rewinding.store(false, std::memory_order_relaxed);
+                }
                 for (int i = 0; i < 16; i++) {
                     if (e.key.keysym.sym == keymap[i]) {
-                        chip8.keypad[i] = 0;
+                        keys.fetch_and(static_cast<uint16_t>(~(1u << i)), std::memory_order_relaxed);
                     }
                 }
             }
         }
 
-        auto curr_cycle = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(curr_cycle - last_cycle).count();
+        events_zone.end();
 
-        if (dt > 3) {
-            last_cycle = curr_cycle;
+        // Take the dirty rows before the frame: they then all belong to frames no newer than the one read.
+        uint32_t rows = dirty.exchange(0, std::memory_order_acquire);
+        bool fresh = frames.update();
+        const Frame& frame = frames.read_buffer();
 
-            if (chip8.get_soundtimer() > 0) {
-                SDL_PauseAudio(0);
-            }
-            else {
-                SDL_PauseAudio(1);
+        if (rows) {
+            // Upload only the band between the first and last changed rows.
+            int first = 0;
+            while (!(rows & (1u << first)))
+                first++;
+            int last = VIDEO_HEIGHT - 1;
+            while (!(rows & (1u << last)))
+                last--;
+
+            SDL_Rect band = { 0, first, VIDEO_WIDTH, last - first + 1 };
+            TimelineZone upload_zone("upload");
+            SDL_UpdateTexture(texture, &band, frame.pixels + first * VIDEO_WIDTH, VIDEO_WIDTH * sizeof(uint32_t));
+            redraw = true;
+        }
+
+        if (fresh) {
+            SDL_PauseAudio(frame.sound_timer > 0 ? 0 : 1);
+
+            if (frame.register_info != shown_registers || frame.trace_size != shown_trace_size
+                || memcmp(frame.trace, shown_trace, frame.trace_size * sizeof(Chip8::TraceEntry))) {
+                shown_registers = frame.register_info;
+                shown_trace_size = frame.trace_size;
+                memcpy(shown_trace, frame.trace, frame.trace_size * sizeof(Chip8::TraceEntry));
+                redraw = true;
             }
-             
-            chip8.cycle(instructions);
-            chip8.print_registers(register_info);
-            
-            SDL_UpdateTexture(texture, nullptr, chip8.video, 64 * sizeof(uint32_t));
-
-            ImGui_ImplSDLRenderer2_NewFrame();
-            ImGui_ImplSDL2_NewFrame();
-            ImGui::NewFrame();
-
-            ImGui::SetNextWindowSize(ImVec2(width, height), ImGuiCond_Always);
-            ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiCond_Always);
-            ImGui::Begin("Chip-8 Emulator", nullptr, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
-
-            ImGui::BeginChild("Instructions", ImVec2(150, height), true);
-            for (int i = 0; i < instructions.size(); i++)
-                ImGui::Text("%s", instructions[i].c_str());
-            if (ImGui::GetScrollY() + ImGui::GetWindowHeight() >= ImGui::GetScrollMaxY())
-                ImGui::SetScrollHereY(1.0f);
-            ImGui::EndChild();
-
-            ImGui::SameLine();
-
-            ImGui::BeginChild("Video", ImVec2(660, 340), true);
-            ImGui::Image(texture, ImVec2(640, 320));
-            ImGui::EndChild();
-
-            ImGui::SameLine();
-
-            ImGui::BeginChild("Registers", ImVec2(200, height), true);
-            for (int i = 0; i < register_info.size(); i++)
-                ImGui::Text("%s", register_info[i].c_str());
-            ImGui::EndChild();
-            ImGui::End();
-            ImGui::Render();
-
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            SDL_RenderClear(renderer);
-            ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
-            SDL_RenderPresent(renderer);
 
+            // Counts move every frame the heatmap is on.
+            if (!frame.heat.empty())
+                redraw = true;
         }
+
+        // A machine waiting on a key or a static screen leaves nothing to draw: skip ImGui and the present.
+        if (!redraw) {
+            wait_next_frame(next_frame);
+            continue;
+        }
+        redraw = false;
+
+        TimelineZone imgui_zone("imgui");
+        ImGui_ImplSDLRenderer2_NewFrame();
+        ImGui_ImplSDL2_NewFrame();
+        ImGui::NewFrame();
+
+        ImGui::SetNextWindowSize(ImVec2(width, height), ImGuiCond_Always);
+        ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiCond_Always);
+        ImGui::Begin("Chip-8 Emulator", nullptr, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
+
+        ImGui::BeginChild("Instructions", ImVec2(150, height), true);
+        ImGuiListClipper clipper;
+        clipper.Begin(frame.trace_size);
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                ImGui::Text("%03X  %04X", frame.trace[i].pc, frame.trace[i].opcode);
+        }
+        if (ImGui::GetScrollY() + ImGui::GetWindowHeight() >= ImGui::GetScrollMaxY())
+            ImGui::SetScrollHereY(1.0f);
+        ImGui::EndChild();
+
+        ImGui::SameLine();
+
+        ImGui::BeginGroup();
+        ImGui::BeginChild("Video", ImVec2(660, 340), true);
+        ImGui::Image(texture, ImVec2(640, 320));
+        ImGui::EndChild();
+
+        ImGui::BeginChild("Heatmap", ImVec2(660, 165), true);
+        bool heatmap_enabled = heatmap.enabled.load(std::memory_order_relaxed);
+        if (ImGui::Checkbox("Heatmap", &heatmap_enabled))
+            heatmap.enabled.store(heatmap_enabled, std::memory_order_relaxed);
+        ImGui::SameLine();
+        if (ImGui::Button("Reset"))
+            heatmap.reset.store(true, std::memory_order_relaxed);
+        ImGui::SameLine();
+        if (ImGui::Button("Export") && !frame.heat.empty()) {
+            std::ofstream file("heatmap.csv");
+            AddressProfile::write_csv(file, frame.heat.data());
+        }
+        if (!frame.heat.empty())
+            draw_heatmap(frame.heat.data());
+        ImGui::EndChild();
+        ImGui::EndGroup();
+
+        ImGui::SameLine();
+
+        ImGui::BeginChild("Registers", ImVec2(200, height), true);
+        for (int i = 0; i < frame.register_info.size(); i++)
+            ImGui::Text("%s", frame.register_info[i].c_str());
+        ImGui::EndChild();
+        ImGui::End();
+        ImGui::Render();
+        imgui_zone.end();
+
+        TimelineZone render_zone("render");
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
+        render_zone.end();
+
+        TimelineZone present_zone("present");
+        SDL_RenderPresent(renderer);
+        present_zone.end();
+
+        wait_next_frame(next_frame);
     }
 
-    instructions.clear();
-    register_info.clear();
+    emulation.join();
+
+    if (movie_file && !movie.save(movie_file))
+        std::cerr << "Could not write movie to " << movie_file << std::endl;
+
+    if (trace_file && !Timeline::write(trace_file))
+        std::cerr << "Could not write trace to " << trace_file << std::endl;
+
     SDL_DestroyTexture(texture);
     SDL_CloseAudio();
     ImGui_ImplSDLRenderer2_Shutdown();
@@ -186,6 +465,7 @@ int main(int argc, char* args[]) {
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
+    timeEndPeriod(1);
 
     return 0;
 }
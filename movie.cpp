@@ -0,0 +1,143 @@
+#include "movie.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "hash.h"
+
+namespace {
+
+const uint8_t MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+const uint16_t MOVIE_VERSION = 1;
+
+void put(std::vector<uint8_t>& out, uint64_t value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+struct Reader {
+	const std::vector<uint8_t>& data;
+	size_t position;
+	bool failed;
+
+	uint64_t get(unsigned int bytes) {
+		uint64_t value = 0;
+		for (unsigned int i = 0; i < bytes; i++) {
+			if (position >= data.size()) {
+				failed = true;
+				return 0;
+			}
+			value |= static_cast<uint64_t>(data[position++]) << (8 * i);
+		}
+		return value;
+	}
+	uint64_t varint() {
+		uint64_t value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7) {
+			uint64_t byte = get(1);
+			value |= (byte & 0x7Fu) << shift;
+			if (!(byte & 0x80u))
+				return value;
+		}
+		failed = true;
+		return 0;
+	}
+};
+
+}
+
+void Movie::record(uint64_t at, uint16_t keys)
+{
+	uint16_t held = events.empty() ? 0 : events.back().keys;
+	if (keys != held)
+		events.push_back({ at, keys });
+}
+
+void Movie::truncate(uint64_t at)
+{
+	while (!events.empty() && events.back().at >= at)
+		events.pop_back();
+}
+
+bool Movie::save(char const* filename) const
+{
+	std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+	put(out, MOVIE_VERSION, 2);
+	put(out, rom_hash, 8);
+	put(out, seed, 8);
+	put(out, cycles_per_frame, 4);
+	put(out, length, 8);
+	put(out, events.size(), 4);
+
+	uint64_t previous = 0;
+	for (const Event& event : events) {
+		uint64_t delta = event.at - previous;
+		while (delta >= 0x80u) {
+			out.push_back(static_cast<uint8_t>(delta | 0x80u));
+			delta >>= 7u;
+		}
+		out.push_back(static_cast<uint8_t>(delta));
+		put(out, event.keys, 2);
+		previous = event.at;
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	file.write(reinterpret_cast<const char*>(out.data()), out.size());
+	return file.good();
+}
+
+bool Movie::load(char const* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	Reader r{ data, 0, false };
+	if (data.size() < sizeof(MOVIE_MAGIC) || memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)))
+		return false;
+	r.position = sizeof(MOVIE_MAGIC);
+	if (r.get(2) != MOVIE_VERSION)
+		return false;
+
+	uint64_t new_rom_hash = r.get(8);
+	uint64_t new_seed = r.get(8);
+	uint32_t new_cycles_per_frame = static_cast<uint32_t>(r.get(4));
+	uint64_t new_length = r.get(8);
+	uint64_t count = r.get(4);
+
+	std::vector<Event> new_events;
+	uint64_t at = 0;
+	// Every event takes at least three bytes, which bounds a corrupt count.
+	for (uint64_t i = 0; i < count && !r.failed && data.size() - r.position >= 3; i++) {
+		at += r.varint();
+		uint16_t keys = static_cast<uint16_t>(r.get(2));
+		new_events.push_back({ at, keys });
+	}
+	if (r.failed || new_events.size() != count || new_cycles_per_frame == 0)
+		return false;
+
+	rom_hash = new_rom_hash;
+	seed = new_seed;
+	cycles_per_frame = new_cycles_per_frame;
+	length = new_length;
+	events.swap(new_events);
+	return true;
+}
+
+uint64_t Movie::hash_rom(const uint8_t* data, size_t size)
+{
+	return fnv1a(data, size);
+}
+
+bool Movie::hash_rom(char const* filename, uint64_t& hash)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	hash = hash_rom(data.data(), data.size());
+	return true;
+}
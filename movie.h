@@ -0,0 +1,48 @@
+#ifndef MOVIE
+#define MOVIE
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A recorded play session: the ROM it ran (by hash), the RNG seed, the frame rate in cycles, and every change
+// of the key mask stamped with the instruction count it took effect at. Replaying the keys on a Chip8 booted
+// the same way reproduces the session exactly, at whatever speed the host runs.
+//
+// File layout, all multi-byte fields little-endian:
+//   "C8MV", u16 version, u64 ROM hash, u64 seed, u32 cycles per frame, u64 length in instructions,
+//   u32 event count, then per event a LEB128 instruction count since the previous event and the u16 mask.
+class Movie {
+public:
+	struct Event {
+		// The mask holds from before instruction `at` on.
+		uint64_t at;
+		uint16_t keys;
+	};
+
+	uint64_t rom_hash = 0;
+	uint64_t seed = 0;
+	uint32_t cycles_per_frame = 10;
+	uint64_t length = 0;
+
+	// Adds an event if `keys` differs from the mask in force at `at`; the keys start released.
+	void record(uint64_t at, uint16_t keys);
+	// Forgets every event at or after `at`, for when the machine is rewound to that instruction.
+	void truncate(uint64_t at);
+
+	const std::vector<Event>& get_events() const {
+		return events;
+	}
+
+	bool save(char const* filename) const;
+	// Leaves the movie untouched if the file is unreadable or malformed.
+	bool load(char const* filename);
+
+	// FNV-1a over the ROM image.
+	static uint64_t hash_rom(const uint8_t* data, size_t size);
+	static bool hash_rom(char const* filename, uint64_t& hash);
+
+private:
+	std::vector<Event> events;
+};
+
+#endif // !MOVIE
@@ -0,0 +1,248 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <vector>
+#include <string>
+
+namespace {
+
+const char* const FAMILY_NAMES[OP_FAMILY_COUNT] = {
+	"NULL",
+	"00E0", "00EE",
+	"1NNN", "2NNN", "3XKK", "4XKK", "5XY0", "6XKK", "7XKK",
+	"8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+	"9XY0", "ANNN", "BNNN", "CXKK", "DXYN",
+	"EX9E", "EXA1",
+	"FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65"
+};
+
+}
+
+const char* op_family_name(OpFamily family)
+{
+	unsigned int i = static_cast<unsigned int>(family);
+	return i < OP_FAMILY_COUNT ? FAMILY_NAMES[i] : "NULL";
+}
+
+OpcodeProfile::OpcodeProfile(unsigned int sample_period) : period(sample_period), clock_overhead_ns(0)
+{
+	reset();
+
+	// The cheapest of a run of back-to-back reads, so a preempted one doesn't inflate it.
+	for (unsigned int i = 0; period && i < 1000; i++) {
+		auto start = std::chrono::steady_clock::now();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (i == 0 || static_cast<uint64_t>(ns) < clock_overhead_ns)
+			clock_overhead_ns = static_cast<uint64_t>(ns);
+	}
+}
+
+void OpcodeProfile::reset()
+{
+	countdown = period;
+	memset(families, 0, sizeof(families));
+}
+
+void OpcodeProfile::sample(uint16_t, uint16_t op, std::chrono::steady_clock::duration elapsed)
+{
+	Family& family = families[static_cast<unsigned int>(op_family(op))];
+	uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	ns = ns > clock_overhead_ns ? ns - clock_overhead_ns : 0;
+
+	unsigned int bucket = 0;
+	while (bucket < BUCKETS - 1 && (ns >> bucket))
+		bucket++;
+
+	family.count++;
+	family.samples++;
+	family.sampled_ns += ns;
+	family.histogram[bucket]++;
+}
+
+uint64_t OpcodeProfile::total() const
+{
+	uint64_t sum = 0;
+	for (const Family& family : families)
+		sum += family.count;
+	return sum;
+}
+
+void OpcodeProfile::write_json(std::ostream& out) const
+{
+	uint64_t all = total();
+	out << "{\n  \"instructions\": " << all << ",\n  \"sample_period\": " << period << ",\n  \"clock_overhead_ns\": " << clock_overhead_ns
+		<< ",\n  \"families\": [";
+
+	bool first = true;
+	for (unsigned int i = 0; i < OP_FAMILY_COUNT; i++) {
+		const Family& family = families[i];
+		if (!family.count)
+			continue;
+
+		out << (first ? "\n" : ",\n") << "    { \"family\": \"" << FAMILY_NAMES[i] << "\", \"count\": " << family.count
+			<< ", \"share\": " << static_cast<double>(family.count) / all;
+		if (period) {
+			out << ", \"samples\": " << family.samples << ", \"mean_ns\": "
+				<< (family.samples ? static_cast<double>(family.sampled_ns) / family.samples : 0) << ", \"histogram\": [";
+			for (unsigned int b = 0; b < BUCKETS; b++)
+				out << (b ? ", " : "") << family.histogram[b];
+			out << "]";
+		}
+		out << " }";
+		first = false;
+	}
+	out << "\n  ]\n}\n";
+}
+
+void OpcodeProfile::write_csv(std::ostream& out) const
+{
+	uint64_t all = total();
+	out << "family,count,share,samples,mean_ns";
+	for (unsigned int b = 0; b < BUCKETS; b++)
+		out << ",lt_" << (b == BUCKETS - 1 ? "inf" : std::to_string(1ull << b)) << "ns";
+	out << "\n";
+
+	for (unsigned int i = 0; i < OP_FAMILY_COUNT; i++) {
+		const Family& family = families[i];
+		if (!family.count)
+			continue;
+
+		out << FAMILY_NAMES[i] << "," << family.count << "," << static_cast<double>(family.count) / all << ","
+			<< family.samples << "," << (family.samples ? static_cast<double>(family.sampled_ns) / family.samples : 0);
+		for (unsigned int b = 0; b < BUCKETS; b++)
+			out << "," << family.histogram[b];
+		out << "\n";
+	}
+}
+
+void AddressProfile::reset()
+{
+	memset(counts, 0, sizeof(counts));
+}
+
+void AddressProfile::write_csv(std::ostream& out, const uint64_t* counts)
+{
+	std::vector<uint16_t> order;
+	uint64_t all = 0;
+	for (unsigned int address = 0; address < ADDRESSES; address++) {
+		all += counts[address];
+		if (counts[address])
+			order.push_back(static_cast<uint16_t>(address));
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b) {
+		return counts[a] > counts[b];
+	});
+
+	out << "address,count,share\n";
+	for (uint16_t address : order) {
+		out << "0x" << std::hex << std::uppercase << std::setw(3) << std::setfill('0') << address << std::dec << std::nouppercase << std::setfill(' ')
+			<< "," << counts[address] << "," << static_cast<double>(counts[address]) / all << "\n";
+	}
+}
+
+void CallProfile::reset()
+{
+	nodes.clear();
+	nodes.push_back({ 0, NO_NODE, NO_NODE, NO_NODE, 0, 0 });
+	current = 0;
+	depth = 0;
+	overflow = 0;
+	instructions = 0;
+	memset(routines, 0, sizeof(routines));
+	memset(active, 0, sizeof(active));
+}
+
+void CallProfile::call(uint16_t routine)
+{
+	routines[routine].calls++;
+	if (depth == MAX_DEPTH) {
+		overflow++;
+		return;
+	}
+
+	uint32_t child = nodes[current].first_child;
+	while (child != NO_NODE && nodes[child].routine != routine)
+		child = nodes[child].next_sibling;
+	if (child == NO_NODE) {
+		child = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({ routine, current, NO_NODE, nodes[current].first_child, 0, 0 });
+		nodes[current].first_child = child;
+	}
+
+	nodes[child].calls++;
+	current = child;
+	depth++;
+
+	if (active[routine].depth++ == 0)
+		active[routine].entered = instructions;
+}
+
+void CallProfile::ret()
+{
+	if (overflow) {
+		overflow--;
+		return;
+	}
+	// A return from a call made before profiling started.
+	if (depth == 0)
+		return;
+
+	uint16_t routine = nodes[current].routine;
+	if (--active[routine].depth == 0)
+		routines[routine].inclusive += instructions - active[routine].entered;
+
+	current = nodes[current].parent;
+	depth--;
+}
+
+CallProfile::Routine CallProfile::routine(uint16_t address) const
+{
+	address &= AddressProfile::ADDRESSES - 1;
+	Routine totals = routines[address];
+	if (active[address].depth)
+		totals.inclusive += instructions - active[address].entered;
+
+	for (size_t i = 1; i < nodes.size(); i++) {
+		if (nodes[i].routine == address)
+			totals.exclusive += nodes[i].exclusive;
+	}
+	return totals;
+}
+
+void CallProfile::write_folded(std::ostream& out) const
+{
+	std::vector<uint16_t> path;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (!nodes[i].exclusive)
+			continue;
+
+		path.clear();
+		for (uint32_t node = static_cast<uint32_t>(i); node != 0; node = nodes[node].parent)
+			path.push_back(nodes[node].routine);
+
+		out << "main";
+		for (auto routine = path.rbegin(); routine != path.rend(); ++routine)
+			out << ";sub_" << std::hex << std::uppercase << std::setw(3) << std::setfill('0') << *routine << std::dec << std::nouppercase << std::setfill(' ');
+		out << " " << nodes[i].exclusive << "\n";
+	}
+}
+
+void CallProfile::write_csv(std::ostream& out) const
+{
+	std::vector<std::pair<uint16_t, Routine>> called;
+	for (unsigned int address = 0; address < AddressProfile::ADDRESSES; address++) {
+		if (routines[address].calls)
+			called.push_back({ static_cast<uint16_t>(address), routine(static_cast<uint16_t>(address)) });
+	}
+	std::stable_sort(called.begin(), called.end(), [](const std::pair<uint16_t, Routine>& a, const std::pair<uint16_t, Routine>& b) {
+		return a.second.inclusive > b.second.inclusive;
+	});
+
+	out << "routine,calls,inclusive,exclusive,inclusive_share\n";
+	for (const auto& entry : called) {
+		out << "0x" << std::hex << std::uppercase << std::setw(3) << std::setfill('0') << entry.first << std::dec << std::nouppercase << std::setfill(' ')
+			<< "," << entry.second.calls << "," << entry.second.inclusive << "," << entry.second.exclusive << ","
+			<< (instructions ? static_cast<double>(entry.second.inclusive) / instructions : 0) << "\n";
+	}
+}
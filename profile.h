@@ -0,0 +1,240 @@
+#ifndef PROFILE
+#define PROFILE
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// One slot of Chip8's dispatch tables. Undefined opcodes all land in Null, as they do in the tables.
+enum class OpFamily : uint8_t {
+	Null,
+	OP_00E0, OP_00EE,
+	OP_1NNN, OP_2NNN, OP_3XKK, OP_4XKK, OP_5XY0, OP_6XKK, OP_7XKK,
+	OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+	OP_9XY0, OP_ANNN, OP_BNNN, OP_CXKK, OP_DXYN,
+	OP_EX9E, OP_EXA1,
+	OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+	Count
+};
+
+const unsigned int OP_FAMILY_COUNT = static_cast<unsigned int>(OpFamily::Count);
+
+// "DXYN" etc., "NULL" for OpFamily::Null.
+const char* op_family_name(OpFamily family);
+
+// The handler Chip8::decode picks for `op`, which is looser than the spec: 5XY1 still runs 5XY0, say.
+inline OpFamily op_family(uint16_t op)
+{
+	static const OpFamily main[16] = {
+		OpFamily::Null, OpFamily::OP_1NNN, OpFamily::OP_2NNN, OpFamily::OP_3XKK, OpFamily::OP_4XKK, OpFamily::OP_5XY0,
+		OpFamily::OP_6XKK, OpFamily::OP_7XKK, OpFamily::Null, OpFamily::OP_9XY0, OpFamily::OP_ANNN, OpFamily::OP_BNNN,
+		OpFamily::OP_CXKK, OpFamily::OP_DXYN, OpFamily::Null, OpFamily::Null
+	};
+	static const OpFamily alu[16] = {
+		OpFamily::OP_8XY0, OpFamily::OP_8XY1, OpFamily::OP_8XY2, OpFamily::OP_8XY3, OpFamily::OP_8XY4, OpFamily::OP_8XY5,
+		OpFamily::OP_8XY6, OpFamily::OP_8XY7, OpFamily::Null, OpFamily::Null, OpFamily::Null, OpFamily::Null,
+		OpFamily::Null, OpFamily::Null, OpFamily::OP_8XYE, OpFamily::Null
+	};
+
+	unsigned int n = op & 0x000Fu;
+	switch (op >> 12u) {
+	case 0x0:
+		return n == 0x0 ? OpFamily::OP_00E0 : n == 0xE ? OpFamily::OP_00EE : OpFamily::Null;
+	case 0x8:
+		return alu[n];
+	case 0xE:
+		return n == 0xE ? OpFamily::OP_EX9E : n == 0x1 ? OpFamily::OP_EXA1 : OpFamily::Null;
+	case 0xF:
+		switch (op & 0x00FFu) {
+		case 0x07: return OpFamily::OP_FX07;
+		case 0x0A: return OpFamily::OP_FX0A;
+		case 0x15: return OpFamily::OP_FX15;
+		case 0x18: return OpFamily::OP_FX18;
+		case 0x1E: return OpFamily::OP_FX1E;
+		case 0x29: return OpFamily::OP_FX29;
+		case 0x33: return OpFamily::OP_FX33;
+		case 0x55: return OpFamily::OP_FX55;
+		case 0x65: return OpFamily::OP_FX65;
+		default: return OpFamily::Null;
+		}
+	default:
+		return main[op >> 12u];
+	}
+}
+
+// Profile policies for Chip8::cycle(Profile&). A policy says whether to time the instruction about to run,
+// and is then handed the instruction's address and opcode with either count() or sample().
+
+// Records nothing: cycle(NoProfile&) compiles to the same code as plain cycle().
+struct NoProfile {
+	bool sampling() {
+		return false;
+	}
+	void count(uint16_t, uint16_t) {}
+	void sample(uint16_t, uint16_t, std::chrono::steady_clock::duration) {}
+};
+
+// Executions per opcode family and, every `sample_period` instructions, the host time one instruction
+// took. The cost of the two clock reads around the handler is measured once up front and taken off each
+// sample, but it is often larger than the handler itself, so compare families rather than trusting the
+// absolute figures.
+class OpcodeProfile {
+public:
+	// Log2 buckets of sampled nanoseconds: bucket b holds times in [2^(b-1), 2^b), the last everything above.
+	static const unsigned int BUCKETS = 16;
+
+	struct Family {
+		uint64_t count;
+		uint64_t samples;
+		uint64_t sampled_ns;
+		uint64_t histogram[BUCKETS];
+	};
+
+	// 0 counts without timing anything.
+	explicit OpcodeProfile(unsigned int sample_period = 0);
+
+	bool sampling() {
+		if (!period || --countdown)
+			return false;
+		countdown = period;
+		return true;
+	}
+	void count(uint16_t, uint16_t op) {
+		families[static_cast<unsigned int>(op_family(op))].count++;
+	}
+	void sample(uint16_t address, uint16_t op, std::chrono::steady_clock::duration elapsed);
+
+	const Family& at(OpFamily family) const {
+		return families[static_cast<unsigned int>(family)];
+	}
+	uint64_t total() const;
+	void reset();
+
+	// One object per family that ran, in table order: name, count, share of all instructions and, when
+	// sampling, samples, mean ns and the histogram. The clock overhead taken off the samples comes first.
+	void write_json(std::ostream& out) const;
+	// One row per family that ran: family,count,share,samples,mean_ns,then one column per bucket.
+	void write_csv(std::ostream& out) const;
+
+private:
+	unsigned int period;
+	unsigned int countdown;
+	uint64_t clock_overhead_ns;
+	Family families[OP_FAMILY_COUNT];
+};
+
+// Executions per address across the 4 KB memory space, for finding a ROM's hot loops. Costs one increment
+// per instruction.
+class AddressProfile {
+public:
+	static const unsigned int ADDRESSES = 4096;
+
+	AddressProfile() {
+		reset();
+	}
+
+	bool sampling() {
+		return false;
+	}
+	void count(uint16_t address, uint16_t) {
+		counts[address & (ADDRESSES - 1)]++;
+	}
+	void sample(uint16_t address, uint16_t op, std::chrono::steady_clock::duration) {
+		count(address, op);
+	}
+
+	// ADDRESSES entries, indexed by address.
+	const uint64_t* get_counts() const {
+		return counts;
+	}
+	void reset();
+
+	// address,count,share for every address that ran, hottest first.
+	static void write_csv(std::ostream& out, const uint64_t* counts);
+	void write_csv(std::ostream& out) const {
+		write_csv(out, counts);
+	}
+
+private:
+	uint64_t counts[ADDRESSES];
+};
+
+// Calling-context profile built from the 2NNN and 00EE instructions as they run. Every instruction is
+// charged to the subroutine executing it (a 2NNN to its caller, a 00EE to the routine it leaves), so each
+// routine gets call, exclusive and inclusive instruction counts, and each distinct call path its own
+// exclusive count for a flame graph. Code outside any call is charged to the root, "main".
+class CallProfile {
+public:
+	// Calls nested deeper than this are counted but charged to the deepest tracked frame.
+	static const unsigned int MAX_DEPTH = 64;
+
+	struct Routine {
+		uint64_t calls;
+		uint64_t exclusive;
+		uint64_t inclusive;
+	};
+
+	CallProfile() {
+		reset();
+	}
+
+	bool sampling() {
+		return false;
+	}
+	void count(uint16_t, uint16_t op) {
+		nodes[current].exclusive++;
+		instructions++;
+		// The same opcode tests as Chip8::decode: 0xxE runs 00EE.
+		if ((op & 0xF000u) == 0x2000u)
+			call(op & 0x0FFFu);
+		else if ((op & 0xF00Fu) == 0x000Eu)
+			ret();
+	}
+	void sample(uint16_t address, uint16_t op, std::chrono::steady_clock::duration) {
+		count(address, op);
+	}
+
+	void reset();
+
+	// Totals for the subroutine at `address`, including calls still open.
+	Routine routine(uint16_t address) const;
+
+	// One line per call path that executed anything, "main;sub_2A4;sub_31C <instructions>", as flamegraph.pl
+	// and speedscope read.
+	void write_folded(std::ostream& out) const;
+	// routine,calls,inclusive,exclusive,inclusive_share for every routine called, most inclusive first.
+	void write_csv(std::ostream& out) const;
+
+private:
+	struct Node {
+		uint16_t routine;
+		uint32_t parent;
+		uint32_t first_child;
+		uint32_t next_sibling;
+		uint64_t calls;
+		uint64_t exclusive;
+	};
+
+	// Per routine: entries not yet returned from, and the instruction count at the outermost one, so
+	// recursion is not counted twice towards inclusive.
+	struct Active {
+		uint32_t depth;
+		uint64_t entered;
+	};
+
+	void call(uint16_t routine);
+	void ret();
+
+	static const uint32_t NO_NODE = 0xFFFFFFFFu;
+
+	std::vector<Node> nodes;
+	uint32_t current;
+	unsigned int depth;
+	// Calls past MAX_DEPTH not yet returned from.
+	unsigned int overflow;
+	uint64_t instructions;
+	Routine routines[AddressProfile::ADDRESSES];
+	Active active[AddressProfile::ADDRESSES];
+};
+
+#endif // !PROFILE
@@ -0,0 +1,152 @@
+#include "rewind.h"
+#include <cstring>
+
+namespace {
+
+void put_varint(std::vector<uint8_t>& out, size_t value)
+{
+	while (value >= 0x80u) {
+		out.push_back(static_cast<uint8_t>(value | 0x80u));
+		value >>= 7u;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+size_t get_varint(const uint8_t*& in)
+{
+	size_t value = 0;
+	for (unsigned int shift = 0;; shift += 7) {
+		uint8_t byte = *in++;
+		value |= static_cast<size_t>(byte & 0x7Fu) << shift;
+		if (!(byte & 0x80u))
+			return value;
+	}
+}
+
+}
+
+Rewind::Rewind(size_t max_frames, size_t max_bytes)
+	: max_frames(max_frames), ring(max_bytes), held(0), has_head(false), head(SNAPSHOT_SIZE), scratch(SNAPSHOT_SIZE)
+{
+	encoded.reserve(SNAPSHOT_SIZE + 64);
+}
+
+void Rewind::clear()
+{
+	records.clear();
+	held = 0;
+	has_head = false;
+}
+
+void Rewind::encode(const uint8_t* a, const uint8_t* b)
+{
+	encoded.clear();
+
+	size_t i = 0;
+	while (i < SNAPSHOT_SIZE) {
+		// Unchanged stretch, a word at a time where it can.
+		size_t skip = i;
+		while (skip + 8 <= SNAPSHOT_SIZE && !memcmp(a + skip, b + skip, 8))
+			skip += 8;
+		while (skip < SNAPSHOT_SIZE && a[skip] == b[skip])
+			skip++;
+
+		// Changed stretch, ended by four unchanged bytes in a row: shorter gaps cost less to copy than to skip.
+		size_t end = skip;
+		for (size_t j = skip; j < SNAPSHOT_SIZE; j++) {
+			if (a[j] != b[j])
+				end = j + 1;
+			else if (j - end >= 3)
+				break;
+		}
+
+		put_varint(encoded, skip - i);
+		put_varint(encoded, end - skip);
+		for (size_t j = skip; j < end; j++)
+			encoded.push_back(a[j] ^ b[j]);
+		i = end;
+	}
+}
+
+void Rewind::apply(const uint8_t* delta, size_t length, uint8_t* state)
+{
+	const uint8_t* end = delta + length;
+	size_t i = 0;
+	while (delta < end) {
+		i += get_varint(delta);
+		size_t literal = get_varint(delta);
+		for (size_t j = 0; j < literal; j++)
+			state[i + j] ^= delta[j];
+		delta += literal;
+		i += literal;
+	}
+}
+
+size_t Rewind::place(size_t length)
+{
+	for (;;) {
+		if (records.empty())
+			return 0;
+
+		// Free space runs from the end of the newest record up to the start of the oldest, round the end of the
+		// ring if the newest is ahead of the oldest.
+		size_t write = records.back().start + records.back().length;
+		size_t oldest = records.front().start;
+		if (write > oldest) {
+			if (ring.size() - write >= length)
+				return write;
+			if (oldest >= length)
+				return 0;
+		}
+		else if (oldest - write >= length) {
+			return write;
+		}
+
+		held -= records.front().length;
+		records.pop_front();
+	}
+}
+
+void Rewind::capture(const Chip8& chip8)
+{
+	chip8.snapshot(scratch.data());
+	if (!has_head) {
+		head.swap(scratch);
+		has_head = true;
+		return;
+	}
+
+	encode(scratch.data(), head.data());
+	head.swap(scratch);
+
+	while (!records.empty() && records.size() >= max_frames) {
+		held -= records.front().length;
+		records.pop_front();
+	}
+
+	// A delta the ring can't hold breaks the chain back to every older frame.
+	if (!max_frames || encoded.size() > ring.size()) {
+		records.clear();
+		held = 0;
+		return;
+	}
+
+	size_t start = place(encoded.size());
+	memcpy(ring.data() + start, encoded.data(), encoded.size());
+	records.push_back({ start, encoded.size() });
+	held += encoded.size();
+}
+
+bool Rewind::step_back(Chip8& chip8)
+{
+	if (records.empty())
+		return false;
+
+	const Record& newest = records.back();
+	apply(ring.data() + newest.start, newest.length, head.data());
+	held -= newest.length;
+	records.pop_back();
+
+	chip8.restore_snapshot(head.data());
+	return true;
+}
@@ -0,0 +1,56 @@
+#ifndef REWIND
+#define REWIND
+#include <deque>
+#include <vector>
+#include "cpu.h"
+
+// History of per-frame machine states for stepping backwards. The newest state is kept whole; every older
+// one is stored as the XOR of it and its successor, run-length encoded over the zero bytes, since a frame
+// usually changes a handful of registers, a few bytes of memory and a few rows of video. The deltas share
+// one fixed byte ring, so the history costs at most `max_bytes` however busy the ROM is; the oldest frames
+// are dropped first.
+class Rewind {
+public:
+	explicit Rewind(size_t max_frames = 3600, size_t max_bytes = 1 << 20);
+
+	// Records the machine's current state as the newest frame.
+	void capture(const Chip8& chip8);
+	// Puts the machine back to the frame before the newest and drops the newest. False, leaving the machine
+	// alone, once no earlier frame is left.
+	bool step_back(Chip8& chip8);
+
+	// Frames step_back can still go back.
+	size_t frames() const {
+		return records.size();
+	}
+	// Bytes of delta held in the ring.
+	size_t bytes() const {
+		return held;
+	}
+	void clear();
+
+private:
+	struct Record {
+		size_t start;
+		size_t length;
+	};
+
+	// Delta encoding: pairs of varint counts, zero bytes to skip then literal bytes to copy, the literals
+	// following their pair, until the snapshot is covered.
+	void encode(const uint8_t* a, const uint8_t* b);
+	void apply(const uint8_t* delta, size_t length, uint8_t* state);
+	// Where a delta of `length` bytes goes, dropping the oldest records until it fits.
+	size_t place(size_t length);
+
+	size_t max_frames;
+	std::vector<uint8_t> ring;
+	std::deque<Record> records;
+	size_t held;
+
+	bool has_head;
+	std::vector<uint8_t> head;
+	std::vector<uint8_t> scratch;
+	std::vector<uint8_t> encoded;
+};
+
+#endif // !REWIND
@@ -0,0 +1,51 @@
+#ifndef RNG
+#define RNG
+#include <cstdint>
+
+// The splitmix64 finalizer: a bijection that spreads every input bit over the whole output. Seeding, the
+// state hash and the explorer's cell keys all mix through it.
+inline uint64_t splitmix64(uint64_t z)
+{
+	z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31u);
+}
+
+// xorshift64* generator: 8 bytes of state, a few instructions per draw and exactly reproducible
+// from its seed. Any type with the same seed/next_byte/get_state/set_state members can stand in
+// for it through Chip8Rng.
+class Xorshift64 {
+public:
+	explicit Xorshift64(uint64_t value = 0) {
+		seed(value);
+	}
+
+	// Seeds go through splitmix64 so that small or similar seeds still give unrelated streams.
+	void seed(uint64_t value) {
+		state = splitmix64(value + 0x9E3779B97F4A7C15ull);
+		// Zero is the one state xorshift never leaves.
+		if (!state)
+			state = 0x9E3779B97F4A7C15ull;
+	}
+
+	uint8_t next_byte() {
+		state ^= state >> 12u;
+		state ^= state << 25u;
+		state ^= state >> 27u;
+		return static_cast<uint8_t>((state * 0x2545F4914F6CDD1Dull) >> 56u);
+	}
+
+	uint64_t get_state() const {
+		return state;
+	}
+	void set_state(uint64_t value) {
+		state = value ? value : 0x9E3779B97F4A7C15ull;
+	}
+
+private:
+	uint64_t state;
+};
+
+typedef Xorshift64 Chip8Rng;
+
+#endif // !RNG
@@ -0,0 +1,308 @@
+#include "cpu.h"
+#include <fstream>
+#include <cstring>
+
+// Save-state layout, all multi-byte fields little-endian:
+//   "C8SV", u16 version
+//   V0-VF, u16 index, u16 pc, u8 sp, u8 delay, u8 sound, u16 keys, min(sp, 16) x u16 stack entries
+//   u64 RNG state
+//   RLE video (256 bytes), RLE memory (4096 bytes)
+// RLE control byte c: c < 0x80 copies the next c + 1 bytes, otherwise the next byte repeats (c & 0x7F) + 2 times.
+
+namespace {
+
+const uint8_t STATE_MAGIC[4] = { 'C', '8', 'S', 'V' };
+const uint16_t STATE_VERSION = 2;
+
+// Counts every byte so the required size is known even when the buffer is too small.
+struct Writer {
+	uint8_t* buffer;
+	size_t capacity;
+	size_t size;
+
+	void byte(uint8_t value) {
+		if (size < capacity)
+			buffer[size] = value;
+		size++;
+	}
+	void u16(uint16_t value) {
+		byte(value & 0xFFu);
+		byte(value >> 8u);
+	}
+	void u64(uint64_t value) {
+		for (int i = 0; i < 8; i++)
+			byte((value >> (8 * i)) & 0xFFu);
+	}
+	void bytes(const uint8_t* data, size_t length) {
+		for (size_t i = 0; i < length; i++)
+			byte(data[i]);
+	}
+	void rle(const uint8_t* data, size_t length) {
+		size_t i = 0;
+		while (i < length) {
+			size_t run = 1;
+			while (i + run < length && run < 129 && data[i + run] == data[i])
+				run++;
+
+			if (run >= 2) {
+				byte(static_cast<uint8_t>(0x80u | (run - 2)));
+				byte(data[i]);
+				i += run;
+				continue;
+			}
+
+			// Literal stretch, up to the next pair of equal bytes.
+			size_t literal = 1;
+			while (i + literal < length && literal < 128 && !(i + literal + 1 < length && data[i + literal] == data[i + literal + 1]))
+				literal++;
+			byte(static_cast<uint8_t>(literal - 1));
+			bytes(data + i, literal);
+			i += literal;
+		}
+	}
+};
+
+struct Reader {
+	const uint8_t* buffer;
+	size_t size;
+	size_t position;
+	bool failed;
+
+	uint8_t byte() {
+		if (position >= size) {
+			failed = true;
+			return 0;
+		}
+		return buffer[position++];
+	}
+	uint16_t u16() {
+		uint16_t low = byte();
+		return low | (byte() << 8u);
+	}
+	uint64_t u64() {
+		uint64_t value = 0;
+		for (int i = 0; i < 8; i++)
+			value |= static_cast<uint64_t>(byte()) << (8 * i);
+		return value;
+	}
+	void bytes(uint8_t* data, size_t length) {
+		for (size_t i = 0; i < length; i++)
+			data[i] = byte();
+	}
+	void rle(uint8_t* data, size_t length) {
+		size_t i = 0;
+		while (i < length && !failed) {
+			uint8_t control = byte();
+			size_t run = control & 0x80u ? (control & 0x7Fu) + 2u : control + 1u;
+			if (i + run > length) {
+				failed = true;
+				return;
+			}
+
+			if (control & 0x80u) {
+				memset(data + i, byte(), run);
+			}
+			else {
+				bytes(data + i, run);
+			}
+			i += run;
+		}
+	}
+};
+
+}
+
+size_t Chip8::save_state(uint8_t* buffer, size_t capacity) const
+{
+	Writer w{ buffer, buffer ? capacity : 0, 0 };
+
+	w.bytes(STATE_MAGIC, sizeof(STATE_MAGIC));
+	w.u16(STATE_VERSION);
+
+	w.bytes(registers, REGISTER_COUNT);
+	w.u16(index);
+	w.u16(pc);
+	w.byte(sp);
+	w.byte(delay_timer);
+	w.byte(sound_timer);
+	w.u16(keys);
+	for (unsigned int i = 0; i < sp && i < STACK_LEVELS; i++)
+		w.u16(stack[i]);
+
+	w.u64(rng.get_state());
+
+	const uint64_t* rows = video.get().rows;
+	uint8_t packed[VIDEO_HEIGHT * 8];
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++) {
+		for (unsigned int i = 0; i < 8; i++)
+			packed[row * 8 + i] = (rows[row] >> (56u - 8u * i)) & 0xFFu;
+	}
+	w.rle(packed, sizeof(packed));
+	uint8_t flat[MEMORY_SIZE];
+	copy_memory(flat);
+	w.rle(flat, MEMORY_SIZE);
+
+	if (!buffer)
+		return w.size;
+	return w.size <= capacity ? w.size : 0;
+}
+
+bool Chip8::load_state(const uint8_t* buffer, size_t size)
+{
+	Reader r{ buffer, size, 0, false };
+
+	uint8_t magic[sizeof(STATE_MAGIC)];
+	r.bytes(magic, sizeof(magic));
+	if (r.failed || memcmp(magic, STATE_MAGIC, sizeof(magic)) || r.u16() != STATE_VERSION)
+		return false;
+
+	// Decode into temporaries so a truncated or corrupt blob leaves the machine untouched.
+	uint8_t new_registers[REGISTER_COUNT];
+	r.bytes(new_registers, REGISTER_COUNT);
+	uint16_t new_index = r.u16();
+	uint16_t new_pc = r.u16();
+	uint8_t new_sp = r.byte();
+	uint8_t new_delay = r.byte();
+	uint8_t new_sound = r.byte();
+	uint16_t new_keys = r.u16();
+	uint16_t new_stack[STACK_LEVELS]{};
+	for (unsigned int i = 0; i < new_sp && i < STACK_LEVELS; i++)
+		new_stack[i] = r.u16();
+
+	uint64_t rng_state = r.u64();
+
+	uint8_t packed[VIDEO_HEIGHT * 8];
+	r.rle(packed, sizeof(packed));
+	uint8_t new_memory[MEMORY_SIZE];
+	r.rle(new_memory, MEMORY_SIZE);
+
+	if (r.failed)
+		return false;
+
+	memcpy(registers, new_registers, sizeof(registers));
+	index = new_index;
+	pc = new_pc;
+	sp = new_sp;
+	delay_timer = new_delay;
+	sound_timer = new_sound;
+	keys = new_keys;
+	memcpy(stack, new_stack, sizeof(stack));
+	rng.set_state(rng_state);
+
+	uint64_t rows[VIDEO_HEIGHT];
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++) {
+		rows[row] = 0;
+		for (unsigned int i = 0; i < 8; i++)
+			rows[row] = (rows[row] << 8u) | packed[row * 8 + i];
+	}
+	// A display that matches stays shared with any forks.
+	if (memcmp(rows, video.get().rows, sizeof(rows)))
+		memcpy(video.write().rows, rows, sizeof(rows));
+
+	mark_dirty(0xFFFFFFFFu);
+	if (hashing)
+		video_hash = hash_video();
+
+	store(0, new_memory, MEMORY_SIZE);
+
+	return true;
+}
+
+bool Chip8::save_state(char const* filename) const
+{
+	std::vector<uint8_t> buffer(save_state(nullptr, 0));
+	save_state(buffer.data(), buffer.size());
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	return file.good();
+}
+
+bool Chip8::load_state(char const* filename)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::streampos size = file.tellg();
+	std::vector<uint8_t> buffer(static_cast<size_t>(size));
+	file.seekg(0, std::ios::beg);
+	file.read(reinterpret_cast<char*>(buffer.data()), size);
+	if (!file)
+		return false;
+
+	return load_state(buffer.data(), buffer.size());
+}
+
+// Snapshot layout: V0-VF, index, pc, sp, delay, sound, keys, the whole stack, RNG state, video words, memory.
+void Chip8::snapshot(uint8_t* out) const
+{
+	uint64_t rng_state = rng.get_state();
+
+	memcpy(out, registers, REGISTER_COUNT);
+	out += REGISTER_COUNT;
+	memcpy(out, &index, 2);
+	memcpy(out + 2, &pc, 2);
+	out[4] = sp;
+	out[5] = delay_timer;
+	out[6] = sound_timer;
+	memcpy(out + 7, &keys, 2);
+	out += 9;
+	memcpy(out, stack, sizeof(stack));
+	out += sizeof(stack);
+	memcpy(out, &rng_state, 8);
+	out += 8;
+	memcpy(out, video.get().rows, sizeof(VideoPage::rows));
+	out += sizeof(VideoPage::rows);
+	copy_memory(out);
+}
+
+void Chip8::restore_snapshot(const uint8_t* in)
+{
+	uint64_t rng_state;
+
+	memcpy(registers, in, REGISTER_COUNT);
+	in += REGISTER_COUNT;
+	memcpy(&index, in, 2);
+	memcpy(&pc, in + 2, 2);
+	sp = in[4];
+	delay_timer = in[5];
+	sound_timer = in[6];
+	memcpy(&keys, in + 7, 2);
+	in += 9;
+	memcpy(stack, in, sizeof(stack));
+	in += sizeof(stack);
+	memcpy(&rng_state, in, 8);
+	rng.set_state(rng_state);
+	in += 8;
+
+	// Pages that match the snapshot are left alone, and stay shared with any forks.
+	uint32_t rows = 0;
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++) {
+		uint64_t word;
+		memcpy(&word, in + row * 8, 8);
+		rows |= static_cast<uint32_t>(word != video.get().rows[row]) << row;
+	}
+	if (rows) {
+		uint64_t before[VIDEO_HEIGHT];
+		memcpy(before, video.get().rows, sizeof(before));
+		memcpy(video.write().rows, in, sizeof(VideoPage::rows));
+		if (hashing)
+			rehash_rows(before, rows);
+	}
+	mark_dirty(rows);
+	in += sizeof(VideoPage::rows);
+
+	for (unsigned int page = 0; page < MEMORY_PAGES; page++) {
+		const uint8_t* bytes = in + page * MEMORY_PAGE_SIZE;
+		if (!memcmp(memory[page].get().bytes, bytes, MEMORY_PAGE_SIZE))
+			continue;
+		for (unsigned int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+			if (memory[page].get().bytes[i] != bytes[i])
+				write(static_cast<uint16_t>(page * MEMORY_PAGE_SIZE + i), &bytes[i], 1);
+		}
+	}
+}
@@ -0,0 +1,146 @@
+#include "timeline.h"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> Timeline::active(false);
+
+namespace {
+
+// Fields are relaxed atomics so write() may read a slot while its thread reuses it; on x86 they compile to
+// plain moves.
+struct Event {
+	std::atomic<const char*> name;
+	std::atomic<uint64_t> begin;
+	std::atomic<uint64_t> end;
+};
+
+struct ThreadBuffer {
+	unsigned int id;
+	std::string name;
+	size_t capacity;
+	std::unique_ptr<Event[]> events;
+	// Events ever recorded; slot written % capacity is the next to fill. claimed runs ahead of written while a
+	// slot is being filled, so a reader can tell which slots changed under it.
+	std::atomic<uint64_t> written{ 0 };
+	std::atomic<uint64_t> claimed{ 0 };
+};
+
+// Buffers outlive their threads, so a trace written after a join still has their events.
+std::mutex registry_lock;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+size_t capacity = 0;
+uint64_t origin = 0;
+
+thread_local ThreadBuffer* local = nullptr;
+thread_local const char* local_name = nullptr;
+
+// Null until start() has been called.
+ThreadBuffer* local_buffer()
+{
+	if (!local) {
+		std::lock_guard<std::mutex> guard(registry_lock);
+		if (!capacity)
+			return nullptr;
+		std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+		buffer->id = static_cast<unsigned int>(registry.size()) + 1;
+		buffer->name = local_name ? local_name : "thread " + std::to_string(buffer->id);
+		buffer->capacity = capacity;
+		buffer->events.reset(new Event[capacity]);
+		local = buffer.get();
+		registry.push_back(std::move(buffer));
+	}
+	return local;
+}
+
+}
+
+void Timeline::start(size_t events_per_thread)
+{
+	{
+		std::lock_guard<std::mutex> guard(registry_lock);
+		if (!capacity) {
+			capacity = events_per_thread ? events_per_thread : 1;
+			origin = now();
+		}
+	}
+	active.store(true, std::memory_order_relaxed);
+}
+
+void Timeline::stop()
+{
+	active.store(false, std::memory_order_relaxed);
+}
+
+void Timeline::name_thread(const char* name)
+{
+	local_name = name;
+	if (local) {
+		std::lock_guard<std::mutex> guard(registry_lock);
+		local->name = name;
+	}
+}
+
+void Timeline::record(const char* name, uint64_t begin, uint64_t end)
+{
+	ThreadBuffer* buffer = local_buffer();
+	if (!buffer)
+		return;
+
+	uint64_t index = buffer->written.load(std::memory_order_relaxed);
+	buffer->claimed.store(index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Event& event = buffer->events[index % buffer->capacity];
+	event.name.store(name, std::memory_order_relaxed);
+	event.begin.store(begin, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	buffer->written.store(index + 1, std::memory_order_release);
+}
+
+bool Timeline::write(const char* filename)
+{
+	std::ofstream out(filename);
+	if (!out.is_open())
+		return false;
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	bool first = true;
+	std::vector<uint64_t> begins, ends;
+	std::vector<const char*> names;
+
+	for (const auto& buffer : registry) {
+		out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+			<< ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+		first = false;
+
+		// Copy the live window out, then drop whatever the thread lapped while it was being copied.
+		uint64_t end = buffer->written.load(std::memory_order_acquire);
+		uint64_t begin = end > buffer->capacity ? end - buffer->capacity : 0;
+		names.clear();
+		begins.clear();
+		ends.clear();
+		for (uint64_t i = begin; i < end; i++) {
+			const Event& event = buffer->events[i % buffer->capacity];
+			names.push_back(event.name.load(std::memory_order_relaxed));
+			begins.push_back(event.begin.load(std::memory_order_relaxed));
+			ends.push_back(event.end.load(std::memory_order_relaxed));
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t lapped = buffer->claimed.load(std::memory_order_relaxed);
+		uint64_t valid = lapped > buffer->capacity ? lapped - buffer->capacity : 0;
+
+		for (uint64_t i = std::max(begin, valid); i < end; i++) {
+			size_t slot = static_cast<size_t>(i - begin);
+			// Timestamps in microseconds from start().
+			out << ",\n{\"name\": \"" << names[slot] << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->id
+				<< ", \"ts\": " << (begins[slot] - origin) / 1000.0 << ", \"dur\": " << (ends[slot] - begins[slot]) / 1000.0 << "}";
+		}
+	}
+
+	out << "\n]}\n";
+	return out.good();
+}
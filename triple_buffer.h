@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER
+#define TRIPLE_BUFFER
+#include <atomic>
+#include <cstdint>
+
+// Single producer, single consumer hand-off without locks. The producer always has a buffer to
+// write into and the consumer always has the most recently published one to read; neither waits.
+template <typename T>
+class TripleBuffer {
+public:
+	// Producer side: fill write_buffer(), then publish() it.
+	T& write_buffer() {
+		return buffers[write_index];
+	}
+
+	void publish() {
+		uint8_t previous = shared.exchange(write_index | FRESH, std::memory_order_acq_rel);
+		write_index = previous & INDEX_MASK;
+	}
+
+	// Consumer side: returns true if a buffer newer than read_buffer() was picked up.
+	bool update() {
+		if (!(shared.load(std::memory_order_relaxed) & FRESH))
+			return false;
+
+		uint8_t previous = shared.exchange(read_index, std::memory_order_acq_rel);
+		read_index = previous & INDEX_MASK;
+		return true;
+	}
+
+	const T& read_buffer() const {
+		return buffers[read_index];
+	}
+
+private:
+	static const uint8_t INDEX_MASK = 0x3u;
+	static const uint8_t FRESH = 0x4u;
+
+	T buffers[3]{};
+	uint8_t write_index = 0;
+	std::atomic<uint8_t> shared{ 1 };
+	uint8_t read_index = 2;
+};
+
+#endif // !TRIPLE_BUFFER